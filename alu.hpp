@@ -0,0 +1,87 @@
+#ifndef alu_hpp
+#define alu_hpp
+
+#include "definitions.hpp"
+
+// register.h
+#define FLAG_Z 0x80
+#define FLAG_N 0x40
+#define FLAG_HC 0x20
+#define FLAG_C 0x10
+
+// Lazy flag operations, see CPU::materialiseFlags()
+enum FlagOp : BYTE{
+    FLAGS_NONE,
+    FLAGS_ADD,
+    FLAGS_SUB,
+    FLAGS_AND,
+    FLAGS_OR,
+    FLAGS_COUNT
+};
+
+// Lookup tables for the 8-bit ALU, generated at compile time
+struct ALUTables{
+    // Z, N and H for each flag operation, indexed by [op][half carry][result]. C is
+    // kept separately by the CPU and OR'd in.
+    BYTE flags[FLAGS_COUNT][2][256];
+
+    // DAA result in the high byte and F in the low byte, indexed by (((F >> 4) & 0x7) << 8) | A.
+    // Only N, H and C of the incoming F matter.
+    WORD daa[8 * 256];
+};
+
+constexpr ALUTables makeALUTables(){
+    ALUTables tables{};
+
+    for(int result = 0; result < 256; result++){
+        BYTE zero = result == 0 ? FLAG_Z : 0;
+        for(int halfCarry = 0; halfCarry < 2; halfCarry++){
+            BYTE hc = halfCarry ? FLAG_HC : 0;
+            tables.flags[FLAGS_NONE][halfCarry][result] = 0;
+            tables.flags[FLAGS_ADD][halfCarry][result] = zero | hc;
+            tables.flags[FLAGS_SUB][halfCarry][result] = zero | FLAG_N | hc;
+            tables.flags[FLAGS_AND][halfCarry][result] = zero | FLAG_HC;
+            tables.flags[FLAGS_OR][halfCarry][result] = zero;
+        }
+    }
+
+    for(int f = 0; f < 8; f++){
+        bool n = f & (FLAG_N >> 4);
+        bool h = f & (FLAG_HC >> 4);
+        bool c = f & (FLAG_C >> 4);
+        for(int a = 0; a < 256; a++){
+            BYTE result = a;
+            BYTE flags = n ? FLAG_N : 0;
+            if(c){
+                flags |= FLAG_C;
+            }
+            if(!n){
+                if(c || result > 0x99){
+                    result += 0x60;
+                    flags |= FLAG_C;
+                }
+                if(h || (result & 0x0F) > 0x09){
+                    result += 0x6;
+                }
+            }
+            else{
+                if(c){
+                    result -= 0x60;
+                }
+                if(h){
+                    result -= 0x6;
+                }
+            }
+            if(result == 0){
+                flags |= FLAG_Z;
+            }
+            tables.daa[(f << 8) | a] = (result << 8) | flags;
+        }
+    }
+
+    return tables;
+}
+
+inline constexpr ALUTables aluTables = makeALUTables();
+
+#endif /* alu_hpp */
@@ -1,8 +1,25 @@
 #include "apu.hpp"
+#include "gameboy.hpp"
 #include "definitions.hpp"
+#include <algorithm>
 
 void APU::reset(){
     
+    if(!gb.headless){
+        openAudio();
+    }
+    
+    // Sound registers and wave RAM, 0xFF27 - 0xFF2F are unused
+    for(WORD address = 0xFF10; address <= 0xFF3F; address++){
+        if(address >= 0xFF27 && address <= 0xFF2F){
+            continue;
+        }
+        gb.mmu.mapIO(address, [](GameBoy& gb, WORD address){ return gb.apu.readByte(address); },
+                              [](GameBoy& gb, WORD address, BYTE val){ gb.apu.writeByte(address, val); });
+    }
+}
+
+void APU::openAudio(){
     SDL_zero(audioSpec);
     audioSpec.freq = 44100;
     audioSpec.format = AUDIO_F32SYS;
@@ -20,6 +37,8 @@ void APU::reset(){
 }
 
 void APU::writeByte(WORD address, BYTE val){
+    catchUp(gb.scheduler.now);
+    
     if(address >= 0xFF10 && address <= 0xFF14){
         tone1.writeByte(address, val);
     }
@@ -45,10 +64,14 @@ void APU::writeByte(WORD address, BYTE val){
             case 0x26:
                 soundControl = (val >> 7) & 0x1;
                 if(!soundControl){
+                    gb.scheduler.cancel(EVENT_FRAME_SEQUENCER);
                     for(int i = 0xFF10; i <= 0xFF25; i++){
                         writeByte(i, 0);
                     }
                 }
+                else{
+                    scheduleFrameSequencer();
+                }
                 break;
             default:
                 break;
@@ -57,6 +80,7 @@ void APU::writeByte(WORD address, BYTE val){
 }
 
 BYTE APU::readByte(WORD address){
+    catchUp(gb.scheduler.now);
     
     BYTE returnValue = 0x0;
     
@@ -96,117 +120,137 @@ BYTE APU::readByte(WORD address){
     
 }
 
-void APU::step(int cycles){
+// Frame sequencer and down sampling
+//
+// Both count clock cycles run while sound is on: the frame sequencer ticks every 8192
+// and a sample is output every 95. The channels are run lazily, up to the master clock
+// whenever a register is touched, the frame sequencer ticks or the frame ends.
+void APU::scheduleFrameSequencer(){
+    gb.scheduler.schedule(EVENT_FRAME_SEQUENCER, syncedTime + (8192 - soundCycles % 8192));
+}
+
+void APU::clockFrameSequencer(uint64_t timestamp){
+    
+    // The tick comes before the channels are stepped for that cycle
+    catchUp(timestamp - 1);
+    
+    switch(clockStep){
+        case 0:
+            tone1.adjustLength();
+            tone2.adjustLength();
+            break;
+        case 2:
+            tone1.adjustSweep();
+            tone1.adjustLength();
+            tone2.adjustLength();
+            break;
+        case 4:
+            tone1.adjustLength();
+            tone2.adjustLength();
+            break;
+        case 6:
+            tone1.adjustSweep();
+            tone1.adjustLength();
+            tone2.adjustLength();
+            break;
+        case 7:
+            tone1.adjustEnvelope();
+            tone2.adjustEnvelope();
+            break;
+    }
+    
+    clockStep++;
+    
+    if (clockStep >= 8) {
+        clockStep = 0;
+    }
+    
+    gb.scheduler.schedule(EVENT_FRAME_SEQUENCER, timestamp + 8192);
+}
+
+void APU::catchUp(uint64_t timestamp){
     
     if(!soundControl){
+        syncedTime = std::max(syncedTime, timestamp);
         return;
     }
     
-    while(cycles-- != 0){
+    while(syncedTime < timestamp){
+        syncedTime++;
+        
+        tone1.step();
+        tone2.step();
         
-        if(--clockCounter <= 0){
-            
-            clockCounter = 8192;
-            
-            switch(clockStep){
+        if(++soundCycles % 95 == 0){
+            outputSample();
+        }
+    }
+}
+
+void APU::outputSample(){
+    
+    // Nothing to play it on
+    if(gb.headless){
+        return;
+    }
+    
+    float bufferIn0 = 0;
+    float bufferIn1 = 0;
+    
+    int volume = (128 * leftOutputLevel) / 7;
+    
+    for(int i = 0; i < 4; i++){
+        if(leftSoundEnable[i]){
+            switch (i) {
                 case 0:
-                    tone1.adjustLength();
-                    tone2.adjustLength();
+                    bufferIn1 = ((float) tone1.getOutputVolume()) / 100;
                     break;
-                case 2:
-                    tone1.adjustSweep();
-                    tone1.adjustLength();
-                    tone2.adjustLength();
+                case 1:
+                    bufferIn1 = ((float) tone2.getOutputVolume()) / 100;
                     break;
-                case 4:
-                    tone1.adjustLength();
-                    tone2.adjustLength();
+                case 2:
                     break;
-                case 6:
-                    tone1.adjustSweep();
-                    tone1.adjustLength();
-                    tone2.adjustLength();
+                case 3:
                     break;
-                case 7:
-                    tone1.adjustEnvelope();
-                    tone2.adjustEnvelope();
+                default:
                     break;
             }
-            
-            clockStep++;
-            
-            if (clockStep >= 8) {
-                clockStep = 0;
-            }
+            SDL_MixAudioFormat((Uint8*) &bufferIn0, (Uint8*) &bufferIn1, AUDIO_F32SYS, sizeof(float), volume);
         }
-        
-        tone1.step();
-        tone2.step();
-        
-        if(--downSampleCount <= 0){
-            downSampleCount = 95;
-            
-            float bufferIn0 = 0;
-            float bufferIn1 = 0;
-            
-            int volume = (128 * leftOutputLevel) / 7;
-            
-            for(int i = 0; i < 4; i++){
-                if(leftSoundEnable[i]){
-                    switch (i) {
-                        case 0:
-                            bufferIn1 = ((float) tone1.getOutputVolume()) / 100;
-                            break;
-                        case 1:
-                            bufferIn1 = ((float) tone2.getOutputVolume()) / 100;
-                            break;
-                        case 2:
-                            break;
-                        case 3:
-                            break;
-                        default:
-                            break;
-                    }
-                    SDL_MixAudioFormat((Uint8*) &bufferIn0, (Uint8*) &bufferIn1, AUDIO_F32SYS, sizeof(float), volume);
-                }
-            }
-            
-            mainBuffer[bufferFillAmount++] = bufferIn0;
-            
-            bufferIn0 = 0;
-            volume = (128 * rightOutputLevel) / 7;
-            
-            for(int i = 0; i < 4; i++){
-                if(rightSoundEnable[i]){
-                    switch (i) {
-                        case 0:
-                            bufferIn1 = ((float) tone1.getOutputVolume()) / 100;
-                            break;
-                        case 1:
-                            bufferIn1 = ((float) tone2.getOutputVolume()) / 100;
-                            break;
-                        case 2:
-                            break;
-                        case 3:
-                            break;
-                        default:
-                            break;
-                    }
-                    SDL_MixAudioFormat((Uint8*) &bufferIn0, (Uint8*) &bufferIn1, AUDIO_F32SYS, sizeof(float), volume);
-                }
+    }
+    
+    mainBuffer[bufferFillAmount++] = bufferIn0;
+    
+    bufferIn0 = 0;
+    volume = (128 * rightOutputLevel) / 7;
+    
+    for(int i = 0; i < 4; i++){
+        if(rightSoundEnable[i]){
+            switch (i) {
+                case 0:
+                    bufferIn1 = ((float) tone1.getOutputVolume()) / 100;
+                    break;
+                case 1:
+                    bufferIn1 = ((float) tone2.getOutputVolume()) / 100;
+                    break;
+                case 2:
+                    break;
+                case 3:
+                    break;
+                default:
+                    break;
             }
-            
-            mainBuffer[bufferFillAmount++] = bufferIn0;
+            SDL_MixAudioFormat((Uint8*) &bufferIn0, (Uint8*) &bufferIn1, AUDIO_F32SYS, sizeof(float), volume);
         }
-        
-        if (bufferFillAmount >= SAMPLESIZE) {
-            bufferFillAmount = 0;
-            while(SDL_GetQueuedAudioSize(1) > SAMPLESIZE * sizeof(float)){
-                SDL_Delay(1);
-            }
-            SDL_QueueAudio(1, mainBuffer, SAMPLESIZE * sizeof(float));
+    }
+    
+    mainBuffer[bufferFillAmount++] = bufferIn0;
+    
+    if (bufferFillAmount >= SAMPLESIZE) {
+        bufferFillAmount = 0;
+        while(SDL_GetQueuedAudioSize(1) > SAMPLESIZE * sizeof(float)){
+            SDL_Delay(1);
         }
+        SDL_QueueAudio(1, mainBuffer, SAMPLESIZE * sizeof(float));
     }
 }
-
-APU apu;
@@ -2,13 +2,18 @@
 #define apu_hpp
 
 #include <SDL2/SDL.h>
+#include <cstdint>
 #include "tone.hpp"
 
 // Sample size for Audio
 #define SAMPLESIZE 4096
 
+class GameBoy;
+
 class APU{
     
+    GameBoy& gb;
+    
     BYTE leftOutputLevel = 0;
     BYTE rightOutputLevel = 0;
     
@@ -23,21 +28,30 @@ class APU{
     SDL_AudioSpec audioSpec;
     SDL_AudioSpec obtainedSpec;
     
-    int downSampleCount = 95;
     int bufferFillAmount = 0;
     float mainBuffer[4096] = { 0 };
     
-    int clockCounter = 8192;
+    // Clock cycles run while sound is on, the frame sequencer and down sampling count these
+    uint64_t soundCycles = 0;
+    // Master clock the channels have been run up to
+    uint64_t syncedTime = 0;
     BYTE clockStep = 0;
     
+    void openAudio();
+    void scheduleFrameSequencer();
+    void outputSample();
+    
 public:
     
+    explicit APU(GameBoy& gb) : gb(gb){}
+    
     void reset();
     void writeByte(WORD address, BYTE val);
     BYTE readByte(WORD address);
-    void step(int cycles);
+    
+    // Runs the channels up to the given master clock timestamp
+    void catchUp(uint64_t timestamp);
+    void clockFrameSequencer(uint64_t timestamp);
 };
 
-extern APU apu;
-
 #endif /* apu_hpp */
@@ -0,0 +1,169 @@
+#include "batch.hpp"
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cstring>
+
+static inline uint64_t packBounds(int front, int back){
+    return ((uint64_t) back << 32) | (uint32_t) front;
+}
+
+Batch::~Batch(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(std::thread& worker : workers){
+        worker.join();
+    }
+}
+
+bool Batch::create(const std::string& romPath, int count, int threads){
+    // The workers index ranges, so neither can be replaced under them
+    if(!machines.empty()){
+        SDL_Log("The batch already has %d machines running %s", size(), path.c_str());
+        return false;
+    }
+    path = romPath;
+    
+    // Every machine after the first shares its ROM image
+    machines.reserve(count);
+    for(int i = 0; i < count; i++){
+        machines.emplace_back(new GameBoy(true));
+        machines.back()->reset();
+        if(!machines.back()->loadROM(path)){
+            machines.clear();
+            return false;
+        }
+    }
+    
+    if(threads <= 0){
+        threads = std::max(1, (int) std::thread::hardware_concurrency());
+    }
+    threads = std::max(1, std::min(threads, count));
+    
+    // Contiguous shares, so neighbouring machines stay on one thread
+    ranges.reset(new Range[threads]);
+    for(int i = 0; i < threads; i++){
+        ranges[i].begin = (int) ((int64_t) count * i / threads);
+        ranges[i].end = (int) ((int64_t) count * (i + 1) / threads);
+        ranges[i].bounds.store(packBounds(ranges[i].end, ranges[i].end));
+    }
+    
+    for(int i = 1; i < threads; i++){
+        workers.emplace_back(&Batch::workerLoop, this, i);
+    }
+    return true;
+}
+
+// Replaced rather than reset, so nothing from the last run carries over. The old machines
+// keep the ROM image cached until the new ones have it, and are only swapped out once
+// every new one has loaded it.
+bool Batch::reset(){
+    std::vector<std::unique_ptr<GameBoy>> fresh;
+    fresh.reserve(machines.size());
+    for(size_t i = 0; i < machines.size(); i++){
+        fresh.emplace_back(new GameBoy(true));
+        fresh.back()->reset();
+        if(!fresh.back()->loadROM(path)){
+            return false;
+        }
+    }
+    machines.swap(fresh);
+    return true;
+}
+
+void Batch::step(const BYTE* stepInputs, int stepFrames, BYTE* stepObservations){
+    inputs = stepInputs;
+    frames = stepFrames;
+    observations = stepObservations;
+    
+    int threads = (int) workers.size() + 1;
+    for(int i = 0; i < threads; i++){
+        ranges[i].bounds.store(packBounds(ranges[i].begin, ranges[i].end), std::memory_order_relaxed);
+    }
+    
+    if(!workers.empty()){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            generation++;
+            running = (int) workers.size();
+        }
+        wake.notify_all();
+    }
+    
+    work(0);
+    
+    if(!workers.empty()){
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]{ return running == 0; });
+    }
+}
+
+void Batch::workerLoop(int worker){
+    uint64_t seen = 0;
+    while(true){
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]{ return stopping || generation != seen; });
+            if(stopping){
+                return;
+            }
+            seen = generation;
+        }
+        
+        work(worker);
+        
+        std::lock_guard<std::mutex> lock(mutex);
+        if(--running == 0){
+            done.notify_one();
+        }
+    }
+}
+
+// Own share first, then whatever the others haven't got to yet
+void Batch::work(int worker){
+    int threads = (int) workers.size() + 1;
+    int machine;
+    
+    while(take(ranges[worker], false, machine)){
+        runMachine(machine);
+    }
+    for(int i = 1; i < threads; i++){
+        Range& victim = ranges[(worker + i) % threads];
+        while(take(victim, true, machine)){
+            runMachine(machine);
+        }
+    }
+}
+
+bool Batch::take(Range& range, bool fromBack, int& machine){
+    uint64_t bounds = range.bounds.load(std::memory_order_relaxed);
+    while(true){
+        int front = (int) (uint32_t) bounds;
+        int back = (int) (bounds >> 32);
+        if(front >= back){
+            return false;
+        }
+        
+        machine = fromBack ? back - 1 : front;
+        uint64_t next = fromBack ? packBounds(front, back - 1) : packBounds(front + 1, back);
+        if(range.bounds.compare_exchange_weak(bounds, next, std::memory_order_relaxed)){
+            return true;
+        }
+    }
+}
+
+void Batch::runMachine(int machine){
+    GameBoy& gb = *machines[machine];
+    
+    if(inputs){
+        gb.joypad.setButtons(inputs[machine]);
+    }
+    for(int i = 0; i < frames; i++){
+        gb.runFrame();
+    }
+    if(observations){
+        memcpy(observations + (size_t) machine * OBSERVATION_LENGTH, gb.ppu.screen(), OBSERVATION_LENGTH);
+    }
+}
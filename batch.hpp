@@ -0,0 +1,79 @@
+#ifndef batch_hpp
+#define batch_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "definitions.hpp"
+#include "gameboy.hpp"
+
+// Bytes of screen copied out per machine by Batch::step(), RGBA
+#define OBSERVATION_LENGTH FRAME_BUFFER_LENGTH
+
+// Many headless machines running the same ROM, stepped together on a pool of threads. Each
+// step applies one input byte to every machine (see JOYPAD::setButtons()), runs them all for
+// the same number of frames and copies out their screens.
+class Batch{
+    
+    // Machines left to run this step from one worker's share, front in the low half and back
+    // in the high half. The owner takes from the front, idle workers steal from the back.
+    struct alignas(64) Range{
+        std::atomic<uint64_t> bounds;
+        int begin;
+        int end;
+    };
+    
+    std::string path;
+    std::vector<std::unique_ptr<GameBoy>> machines;
+    
+    // One per worker, the caller of step() being worker 0
+    std::unique_ptr<Range[]> ranges;
+    std::vector<std::thread> workers;
+    
+    // The current step, set before the workers are woken
+    const BYTE* inputs = nullptr;
+    BYTE* observations = nullptr;
+    int frames = 0;
+    
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    uint64_t generation = 0;
+    int running = 0;
+    bool stopping = false;
+    
+    void workerLoop(int worker);
+    void work(int worker);
+    bool take(Range& range, bool fromBack, int& machine);
+    void runMachine(int machine);
+    
+public:
+    
+    Batch() = default;
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+    ~Batch();
+    
+    // Powers on count machines running the ROM at path, on the given number of threads or one
+    // per core. Logs why through SDL_Log and returns false if the ROM can't be loaded, or if
+    // the batch has already been created.
+    bool create(const std::string& romPath, int count, int threads = 0);
+    
+    int size() const { return (int) machines.size(); }
+    GameBoy& machine(int i){ return *machines[i]; }
+    
+    // Powers every machine back on. Logs why through SDL_Log and returns false, leaving every
+    // machine as it was, if the ROM can't be loaded again.
+    bool reset();
+    
+    // inputs has a byte per machine, or is nullptr to keep the buttons held. observations gets
+    // OBSERVATION_LENGTH bytes per machine, or is nullptr to read machine(i).ppu.screen() instead.
+    void step(const BYTE* inputs, int frames, BYTE* observations);
+};
+
+#endif /* batch_hpp */
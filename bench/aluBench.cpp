@@ -0,0 +1,160 @@
+//
+//  aluBench.cpp
+//  gameboy emulator
+//
+//  Compares the constexpr ALU tables in alu.hpp against the branchy flag code they
+//  replaced. Standalone, build from the repository root with:
+//
+//      c++ -std=c++17 -O2 -I. bench/aluBench.cpp -o aluBench
+//
+
+#include "alu.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Reference implementations, the eager flag code CPU_ADD/CPU_SUB/CPU_DAA started out with
+static BYTE branchyAdd(BYTE& a, BYTE b, bool carryIn){
+    BYTE prev = a;
+    BYTE carryVal = carryIn ? 1 : 0;
+    unsigned int result = prev + b + carryVal;
+    a = result;
+    BYTE f = 0;
+    if(a == 0){
+        f |= FLAG_Z;
+    }
+    if((prev & 0xF) + (b & 0xF) + carryVal > 0xF){
+        f |= FLAG_HC;
+    }
+    if((result & 0x100) != 0){
+        f |= FLAG_C;
+    }
+    return f;
+}
+
+static BYTE branchySub(BYTE& a, BYTE b, bool carryIn){
+    BYTE prev = a;
+    BYTE carryVal = carryIn ? 1 : 0;
+    int subtracting = prev - b - carryVal;
+    a = subtracting;
+    BYTE f = FLAG_N;
+    if(a == 0){
+        f |= FLAG_Z;
+    }
+    if(((prev & 0xF) - (b & 0xF) - carryVal) < 0){
+        f |= FLAG_HC;
+    }
+    if(subtracting < 0){
+        f |= FLAG_C;
+    }
+    return f;
+}
+
+static BYTE branchyDAA(BYTE& a, BYTE f){
+    if(!(f & FLAG_N)){
+        if((f & FLAG_C) || a > 0x99){
+            a += 0x60;
+            f |= FLAG_C;
+        }
+        if((f & FLAG_HC) || (a & 0x0F) > 0x09){
+            a += 0x6;
+        }
+    }
+    else{
+        if(f & FLAG_C){
+            a -= 0x60;
+        }
+        if(f & FLAG_HC){
+            a -= 0x6;
+        }
+    }
+    f &= ~(FLAG_Z | FLAG_HC);
+    if(a == 0){
+        f |= FLAG_Z;
+    }
+    return f;
+}
+
+// Table versions. CPU_DAA works like tableDAA(). CPU_ADD/CPU_SUB only store their operands
+// through setFlags(), and materialiseFlags() reads the flag table when F is needed, so
+// tableAddSub() is eager flags through the table, timed for comparison and not used.
+static BYTE tableAddSub(BYTE& a, BYTE b, bool carryIn, bool subtract){
+    BYTE prev = a;
+    int result = subtract ? prev - b - carryIn : prev + b + carryIn;
+    a = result;
+    int halfCarry = ((prev ^ b ^ a) >> 4) & 0x1;
+    return aluTables.flags[subtract ? FLAGS_SUB : FLAGS_ADD][halfCarry][a] | ((result & 0x100) ? FLAG_C : 0);
+}
+
+static BYTE tableDAA(BYTE& a, BYTE f){
+    WORD entry = aluTables.daa[(((f >> 4) & 0x7) << 8) | a];
+    a = entry >> 8;
+    return entry & 0xFF;
+}
+
+static int verify(){
+    int failures = 0;
+    for(int a = 0; a < 256; a++){
+        for(int b = 0; b < 256; b++){
+            for(int c = 0; c < 2; c++){
+                BYTE a1 = a, a2 = a;
+                if(branchyAdd(a1, b, c) != tableAddSub(a2, b, c, false) || a1 != a2){
+                    failures++;
+                }
+                a1 = a; a2 = a;
+                if(branchySub(a1, b, c) != tableAddSub(a2, b, c, true) || a1 != a2){
+                    failures++;
+                }
+            }
+        }
+        for(int f = 0; f < 256; f += 0x10){
+            BYTE a1 = a, a2 = a;
+            BYTE f1 = branchyDAA(a1, f);
+            BYTE f2 = tableDAA(a2, f);
+            if(f1 != f2 || a1 != a2){
+                failures++;
+            }
+        }
+    }
+    return failures;
+}
+
+template<typename Op>
+static double measure(const char* name, const BYTE* inputs, int count, Op op){
+    unsigned int sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int round = 0; round < 200; round++){
+        for(int i = 0; i < count; i += 2){
+            sink += op(inputs[i], inputs[i + 1]);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / (200.0 * count / 2);
+    printf("%-14s %6.2f ns/op   (checksum %u)\n", name, ns, sink);
+    return ns;
+}
+
+int main(){
+    int failures = verify();
+    if(failures){
+        printf("tables disagree with the reference implementation in %d cases\n", failures);
+        return 1;
+    }
+    printf("tables match the reference implementation\n");
+
+    const int count = 1 << 16;
+    static BYTE inputs[count];
+    srand(1);
+    for(int i = 0; i < count; i++){
+        inputs[i] = rand() & 0xFF;
+    }
+
+    measure("ADC branchy", inputs, count, [](BYTE a, BYTE b){ BYTE f = branchyAdd(a, b, b & 1); return a + f; });
+    measure("ADC table", inputs, count, [](BYTE a, BYTE b){ BYTE f = tableAddSub(a, b, b & 1, false); return a + f; });
+    measure("SBC branchy", inputs, count, [](BYTE a, BYTE b){ BYTE f = branchySub(a, b, b & 1); return a + f; });
+    measure("SBC table", inputs, count, [](BYTE a, BYTE b){ BYTE f = tableAddSub(a, b, b & 1, true); return a + f; });
+    measure("DAA branchy", inputs, count, [](BYTE a, BYTE b){ BYTE f = branchyDAA(a, b & 0x70); return a + f; });
+    measure("DAA table", inputs, count, [](BYTE a, BYTE b){ BYTE f = tableDAA(a, b & 0x70); return a + f; });
+
+    return 0;
+}
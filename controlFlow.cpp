@@ -0,0 +1,353 @@
+#include "controlFlow.hpp"
+#include "romImage.hpp"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+// The entry point, then the interrupt vectors
+static const WORD entryPoints[] = {0x0100, 0x0040, 0x0048, 0x0050, 0x0058, 0x0060};
+
+// The cartridge header, between the entry point and the code it jumps to
+#define HEADER_START 0x0104
+#define HEADER_END 0x0150
+
+// Most entries read from one jump table, as many as an index doubled in A can reach
+#define JUMP_TABLE_LENGTH 128
+
+// Runs task for 0 to count - 1, a task at a time on one thread per core, or on the caller
+// alone when there's too little to share
+template<typename Task>
+static void forEachBank(int count, Task task){
+    int threads = std::max(1, std::min((int) std::thread::hardware_concurrency(), count / 8));
+    std::atomic<int> next(0);
+    auto work = [&]{
+        for(int i = next++; i < count; i = next++){
+            task(i);
+        }
+    };
+    
+    std::vector<std::thread> helpers;
+    for(int i = 1; i < threads; i++){
+        helpers.emplace_back(work);
+    }
+    work();
+    for(std::thread& helper : helpers){
+        helper.join();
+    }
+}
+
+// Each round walks every bank with starts waiting at once. The starts each walk found in
+// other banks are handed out between rounds in bank order, so what's found doesn't depend
+// on how the threads ran.
+ControlFlow::ControlFlow(const ROMImage& rom) : rom(rom){
+    int count = rom.bankCount();
+    flowMarks.reset(new BYTE[(size_t) count * ROM_BANK_SIZE]());
+    banks.resize(count);
+    exits.resize(count);
+    
+    for(int i = HEADER_START; i < HEADER_END; i++){
+        flowMarks[i] = FLOW_DATA;
+    }
+    
+    std::vector<std::vector<Start>> pending(count);
+    std::vector<std::vector<Start>> found(count);
+    for(WORD entry : entryPoints){
+        pending[0].push_back({entry, 1, FLOW_BLOCK | FLOW_ENTRY});
+    }
+    
+    std::vector<int> ready;
+    while(true){
+        ready.clear();
+        for(int i = 0; i < count; i++){
+            if(!pending[i].empty()){
+                ready.push_back(i);
+            }
+        }
+        if(ready.empty()){
+            break;
+        }
+        
+        forEachBank((int) ready.size(), [&](int i){
+            walk(ready[i], pending[ready[i]], found[ready[i]]);
+        });
+        
+        for(int number : ready){
+            pending[number].clear();
+        }
+        for(int i = 0; i < count; i++){
+            for(const Start& start : found[i]){
+                pending[start.offset / ROM_BANK_SIZE].push_back(start);
+            }
+            found[i].clear();
+        }
+    }
+    
+    forEachBank(count, [&](int i){
+        buildBlocks(i);
+    });
+    exits.clear();
+}
+
+int ControlFlow::unresolved() const{
+    int total = 0;
+    for(const BankFlow& flow : banks){
+        total += flow.unresolved;
+    }
+    return total;
+}
+
+// ROM offset of code at address with bank in the switchable area, or -1 if it isn't in ROM
+long ControlFlow::resolve(WORD address, int bank) const{
+    if(address < 0x4000){
+        return address;
+    }
+    if(address < 0x8000){
+        return (long) (bank % rom.bankCount()) * ROM_BANK_SIZE + (address - 0x4000);
+    }
+    return -1;
+}
+
+// The bank after a write of val to address, as MMU::handleBanking() would have it
+int ControlFlow::selectBank(int bank, WORD address, BYTE val) const{
+    if(rom.type() >= 0x19 && rom.type() <= 0x1E){
+        if(address >= 0x2000 && address < 0x3000){
+            return (bank & 0x100) | val;
+        }
+        if(address >= 0x3000 && address < 0x4000){
+            return ((val & 0x1) << 8) | (bank & 0xFF);
+        }
+        return bank;
+    }
+    if(rom.type() < 1 || rom.type() > 3){
+        return bank;
+    }
+    if(address >= 0x2000 && address < 0x4000){
+        bank = (bank & 0xE0) | (val & 0x1F);
+        return (bank & 0x1F) ? bank : bank + 1;
+    }
+    if(address >= 0x4000 && address < 0x6000){
+        bank = ((val & 0x3) << 5) + (bank & 0x1F);
+        return bank ? bank : 1;
+    }
+    return bank;
+}
+
+// Walks one bank's code from starts, instruction by instruction up to the end of each run.
+// Only touches the bank's own marks and exits, targets in other banks go into found.
+void ControlFlow::walk(int number, std::vector<Start>& starts, std::vector<Start>& found){
+    BYTE* marks = flowMarks.get() + (size_t) number * ROM_BANK_SIZE;
+    const DecodedInstruction* decoded = rom.decodedBank(number);
+    WORD base = number ? 0x4000 : 0x0000;
+    BankFlow& flow = banks[number];
+    
+    std::vector<Start> local(starts.rbegin(), starts.rend());
+    auto follow = [&](WORD address, int bank, BYTE mark, int at, FlowEdgeKind kind){
+        long offset = resolve(address, bank);
+        if(offset < 0){
+            flow.unresolved++;
+            return;
+        }
+        exits[number].push_back({(WORD) at, {(uint32_t) offset, kind}});
+        Start start = {(uint32_t) offset, bank, (BYTE) (mark | FLOW_BLOCK)};
+        if(offset / ROM_BANK_SIZE == number){
+            local.push_back(start);
+        }
+        else{
+            found.push_back(start);
+        }
+    };
+    
+    while(!local.empty()){
+        Start start = local.back();
+        local.pop_back();
+        
+        // Into the middle of an instruction, or data, is left to run as it's reached
+        int at = (int) (start.offset % ROM_BANK_SIZE);
+        if(marks[at] & (FLOW_OPERAND | FLOW_DATA)){
+            continue;
+        }
+        bool walked = marks[at] & FLOW_CODE;
+        marks[at] |= start.marks;
+        if(walked){
+            continue;
+        }
+        
+        // LD A,n8 then LD (a16),A selects a bank. A table dispatch loads HL or DE with the
+        // table's address, then H or L from the table.
+        int bank = number ? number : start.bank;
+        int constantA = -1;
+        int table = -1;
+        bool pointerLoaded = false;
+        
+        while(true){
+            const DecodedInstruction& instruction = decoded[at];
+            const OpcodeInfo& info = instructionInfo(instruction);
+            if(!instruction.length || !info.cycles){
+                break;
+            }
+            
+            marks[at] |= FLOW_CODE;
+            for(int i = 1; i < instruction.length; i++){
+                marks[at + i] |= FLOW_OPERAND;
+            }
+            
+            WORD handler = instruction.handler;
+            if(handler == 0xEA && constantA >= 0){
+                bank = selectBank(bank, instruction.operand, (BYTE) constantA);
+            }
+            constantA = handler == 0x3E ? instruction.operand & 0xFF : -1;
+            if(handler == 0x11 || handler == 0x21){
+                table = instruction.operand;
+                pointerLoaded = false;
+            }
+            else if(handler == 0x2A || handler == 0x56 || handler == 0x5E || handler == 0x66 || handler == 0x6E){
+                pointerLoaded = true;
+            }
+            
+            int next = at + instruction.length;
+            WORD nextAddress = base + next;
+            if(!info.endsBlock){
+                // Running on into the next bank is left to run as it's reached
+                if(next >= ROM_BANK_SIZE || (marks[next] & (FLOW_OPERAND | FLOW_DATA))){
+                    break;
+                }
+                if(marks[next] & FLOW_CODE){
+                    marks[next] |= FLOW_BLOCK;
+                    break;
+                }
+                at = next;
+                continue;
+            }
+            
+            if(handler == 0xC3 || (handler & 0xE7) == 0xC2){
+                follow(instruction.operand, bank, FLOW_JUMP_TARGET, at, EDGE_JUMP);
+            }
+            else if(handler == 0x18 || (handler & 0xE7) == 0x20){
+                follow((WORD) (nextAddress + (SIGNED_BYTE) instruction.operand), bank, FLOW_JUMP_TARGET, at, EDGE_JUMP);
+            }
+            else if(handler == 0xCD || (handler & 0xE7) == 0xC4){
+                follow(instruction.operand, bank, FLOW_CALL_TARGET, at, EDGE_CALL);
+            }
+            else if((handler & 0xC7) == 0xC7){
+                follow(handler & 0x38, bank, FLOW_CALL_TARGET | FLOW_ENTRY, at, EDGE_CALL);
+            }
+            else if(handler == 0xE9){
+                std::vector<WORD> entries;
+                if(table >= 0 && pointerLoaded){
+                    entries = readJumpTable(number, (WORD) table, bank);
+                }
+                for(WORD entry : entries){
+                    follow(entry, bank, FLOW_JUMP_TARGET, at, EDGE_TABLE);
+                }
+                if(entries.empty()){
+                    flow.unresolved++;
+                }
+            }
+            
+            // Everything but JP, JR, RET, RETI and JP HL can carry on
+            bool carriesOn = handler != 0xC3 && handler != 0x18 && handler != 0xC9 && handler != 0xD9 && handler != 0xE9;
+            if(carriesOn && next < ROM_BANK_SIZE){
+                follow(nextAddress, bank, 0, at, EDGE_NEXT);
+            }
+            break;
+        }
+    }
+}
+
+// The entries of a jump table at a constant address in the bank being walked, marked as
+// data. The table ends at the first entry that isn't a ROM address with a legal instruction
+// there, at code or where an entry points, or after JUMP_TABLE_LENGTH entries. Empty if
+// it's in another bank.
+std::vector<WORD> ControlFlow::readJumpTable(int number, WORD table, int bank){
+    std::vector<WORD> entries;
+    long offset = resolve(table, bank);
+    if(offset < 0 || offset / ROM_BANK_SIZE != number){
+        return entries;
+    }
+    
+    BYTE* marks = flowMarks.get() + (size_t) number * ROM_BANK_SIZE;
+    const BYTE* bytes = rom.bank(number);
+    long end = (long) (number + 1) * ROM_BANK_SIZE;
+    for(int at = (int) (offset % ROM_BANK_SIZE); at + 1 < ROM_BANK_SIZE && entries.size() < JUMP_TABLE_LENGTH; at += 2){
+        if((long) number * ROM_BANK_SIZE + at + 1 >= end){
+            break;
+        }
+        BYTE both = marks[at] | marks[at + 1];
+        if((both & (FLOW_CODE | FLOW_OPERAND)) || ((both & FLOW_DATA) && !(both & FLOW_TABLE))){
+            break;
+        }
+        
+        WORD entry = (WORD) (bytes[at] | (bytes[at + 1] << 8));
+        long target = resolve(entry, bank);
+        if(target < 0 || (entry >= HEADER_START && entry < HEADER_END)){
+            break;
+        }
+        const DecodedInstruction& instruction = rom.decodedBank(0)[target];
+        if(!instruction.length || !instructionInfo(instruction).cycles){
+            break;
+        }
+        
+        if(target > offset){
+            end = std::min(end, target);
+        }
+        
+        marks[at] |= FLOW_DATA | FLOW_TABLE;
+        marks[at + 1] |= FLOW_DATA | FLOW_TABLE;
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+// Splits the bank's code into basic blocks, each from a block start up to the first
+// instruction that ends one or just before the next block start
+void ControlFlow::buildBlocks(int number){
+    BYTE* marks = flowMarks.get() + (size_t) number * ROM_BANK_SIZE;
+    const DecodedInstruction* decoded = rom.decodedBank(number);
+    uint32_t bankStart = (uint32_t) number * ROM_BANK_SIZE;
+    BankFlow& flow = banks[number];
+    
+    std::vector<Exit>& bankExits = exits[number];
+    std::stable_sort(bankExits.begin(), bankExits.end(), [](const Exit& a, const Exit& b){
+        return a.at < b.at;
+    });
+    size_t nextExit = 0;
+    
+    int at = 0;
+    while(at < ROM_BANK_SIZE){
+        if(!(marks[at] & FLOW_CODE)){
+            at++;
+            continue;
+        }
+        
+        marks[at] |= FLOW_BLOCK;
+        BasicBlock block = {(WORD) at, 0, (uint32_t) flow.edges.size(), 0};
+        while(true){
+            const DecodedInstruction& instruction = decoded[at];
+            int last = at;
+            at += instruction.length;
+            
+            if(instructionInfo(instruction).endsBlock){
+                while(nextExit < bankExits.size() && bankExits[nextExit].at < last){
+                    nextExit++;
+                }
+                for(; nextExit < bankExits.size() && bankExits[nextExit].at == last; nextExit++){
+                    flow.edges.push_back(bankExits[nextExit].edge);
+                }
+                break;
+            }
+            if(at >= ROM_BANK_SIZE || !(marks[at] & FLOW_CODE)){
+                break;
+            }
+            if(marks[at] & FLOW_BLOCK){
+                flow.edges.push_back({bankStart + at, EDGE_NEXT});
+                break;
+            }
+        }
+        
+        block.length = (WORD) (at - block.start);
+        block.edgeCount = (uint32_t) (flow.edges.size() - block.firstEdge);
+        flow.blocks.push_back(block);
+    }
+    
+    std::vector<Exit>().swap(bankExits);
+}
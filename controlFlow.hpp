@@ -0,0 +1,104 @@
+#ifndef controlFlow_hpp
+#define controlFlow_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "definitions.hpp"
+#include "isa.hpp"
+
+class ROMImage;
+
+// What's known about each byte of the ROM, see ControlFlow::marks()
+enum FlowMark : BYTE{
+    FLOW_CODE = 0x01,           // an instruction starts here
+    FLOW_OPERAND = 0x02,        // inside an instruction
+    FLOW_BLOCK = 0x04,          // a basic block starts here
+    FLOW_JUMP_TARGET = 0x08,
+    FLOW_CALL_TARGET = 0x10,
+    FLOW_ENTRY = 0x20,          // the entry point, an interrupt vector or an RST vector
+    FLOW_DATA = 0x40,           // read as data, the header or a jump table
+    FLOW_TABLE = 0x80           // part of a jump table
+};
+
+enum FlowEdgeKind : BYTE{
+    EDGE_NEXT,                  // falls through, or returns after a call
+    EDGE_JUMP,
+    EDGE_CALL,
+    EDGE_TABLE                  // an entry in a jump table
+};
+
+struct FlowEdge{
+    uint32_t target;            // ROM offset
+    FlowEdgeKind kind;
+};
+
+struct BasicBlock{
+    WORD start;                 // offset into the bank
+    WORD length;                // in bytes
+    uint32_t firstEdge;         // into BankFlow::edges
+    uint32_t edgeCount;
+};
+
+// A bank's part of the index
+struct BankFlow{
+    std::vector<BasicBlock> blocks;     // in order
+    std::vector<FlowEdge> edges;
+    int unresolved = 0;                 // jumps through HL, and targets outside ROM
+};
+
+// Control flow recovered from a ROM without running it, a bank per task on a thread per
+// core. Code is walked from the entry point and the interrupt vectors through every jump,
+// call and RST with a constant target, and the jump tables dispatched through JP HL after
+// HL is loaded from a table at a constant address.
+//
+// A target in the switchable area is taken to be in the bank selected by the last constant
+// MBC1 or MBC5 write before it on the way there, in the code's own bank otherwise, or bank
+// 1 for code in bank 0 reached from nowhere else. Code only reached through a bank switch
+// the walk can't follow isn't found, and is left to run as it's reached.
+class ControlFlow{
+    
+    const ROMImage& rom;
+    
+    // FlowMark bits for every byte of the ROM
+    std::unique_ptr<BYTE[]> flowMarks;
+    std::vector<BankFlow> banks;
+    
+    // A block start reached from code, and the bank taken to be in the switchable area
+    struct Start{
+        uint32_t offset;
+        int bank;
+        BYTE marks;
+    };
+    
+    // The instruction ending a block, and one of the places it goes
+    struct Exit{
+        WORD at;
+        FlowEdge edge;
+    };
+    std::vector<std::vector<Exit>> exits;
+    
+    long resolve(WORD address, int bank) const;
+    int selectBank(int bank, WORD address, BYTE val) const;
+    void walk(int number, std::vector<Start>& starts, std::vector<Start>& found);
+    std::vector<WORD> readJumpTable(int number, WORD table, int bank);
+    void buildBlocks(int number);
+    
+public:
+    
+    explicit ControlFlow(const ROMImage& rom);
+    ControlFlow(const ControlFlow&) = delete;
+    ControlFlow& operator=(const ControlFlow&) = delete;
+    
+    BYTE marks(size_t offset) const { return flowMarks[offset]; }
+    const BankFlow& bank(int number) const { return banks[number]; }
+    
+    bool isBlockStart(size_t offset) const { return (flowMarks[offset] & (FLOW_CODE | FLOW_BLOCK)) == (FLOW_CODE | FLOW_BLOCK); }
+    bool isData(size_t offset) const { return flowMarks[offset] & FLOW_DATA; }
+    
+    // Jumps through HL not from a table, and targets outside ROM, across every bank
+    int unresolved() const;
+};
+
+#endif /* controlFlow_hpp */
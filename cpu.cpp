@@ -1,6 +1,50 @@
 #include "cpu.hpp"
-#include "mmu.hpp"
+#include "gameboy.hpp"
+#include "isa.hpp"
 #include "bitOperations.hpp"
+#ifdef GB_JIT_ENABLED
+#include "jit.hpp"
+#endif
+#include <cassert>
+#include <cstring>
+
+// Lazy flags
+//
+// The 8-bit arithmetic/logical instructions only record their operands, result and
+// carry here. Z, N and H are worked out and written to AF.lo the first time something
+// reads F, which for most instructions never happens before the next ALU op.
+void CPU::setFlags(BYTE op, BYTE left, BYTE right, BYTE result, bool carry){
+    regs.flagOp = op;
+    regs.flagLeft = left;
+    regs.flagRight = right;
+    regs.flagResult = result;
+    regs.flagCarry = carry;
+}
+
+void CPU::materialiseFlags(){
+    if(regs.flagOp == FLAGS_NONE){
+        return;
+    }
+    
+    int halfCarry = ((regs.flagLeft ^ regs.flagRight ^ regs.flagResult) >> 4) & 0x1;
+    regs.AF.lo = aluTables.flags[regs.flagOp][halfCarry][regs.flagResult] | (regs.flagCarry ? FLAG_C : 0);
+    regs.flagOp = FLAGS_NONE;
+}
+
+BYTE& CPU::flags(){
+    materialiseFlags();
+    return regs.AF.lo;
+}
+
+bool CPU::carryFlag(){
+    return regs.flagOp == FLAGS_NONE ? (regs.AF.lo & FLAG_C) != 0 : regs.flagCarry;
+}
+
+// Overwrites every flag, dropping whatever is still pending
+void CPU::writeFlags(BYTE f){
+    regs.flagOp = FLAGS_NONE;
+    regs.AF.lo = f;
+}
 
 // 8-bit loads
 void CPU::CPU_LOAD(BYTE& b1, const BYTE& b2){
@@ -8,7 +52,7 @@ void CPU::CPU_LOAD(BYTE& b1, const BYTE& b2){
 }
 
 void CPU::CPU_LOAD_WRITE(const WORD& w, const BYTE& b){
-    mmu.writeByte(w, b);
+    gb.mmu.writeByte(w, b);
 }
 
 // 16-bit loads
@@ -16,267 +60,120 @@ void CPU::CPU_LOAD_16BIT(WORD& reg, const WORD& val, const SIGNED_BYTE& immValue
     reg = val;
     if(isStackPointer){
         int result = val + immValue;
-        AF.lo = 0;
-        if(((val ^ immValue ^ (result & 0xFFFF)) & 0x10) == 0x10){
-            flagBit(AF.lo, FLAG_HC);
-        }
-        if(((val ^ immValue ^ (result & 0xFFFF)) & 0x100) == 0x100){
-            flagBit(AF.lo, FLAG_C);
-        }
+        int carries = val ^ immValue ^ (result & 0xFFFF);
+        writeFlags(((carries & 0x10) ? FLAG_HC : 0) | ((carries & 0x100) ? FLAG_C : 0));
         reg = result;
     }
 }
 
 void CPU::CPU_LOAD_WRITE_16BIT(const WORD& w, const WORD& b){
-    mmu.writeWord(w, b);
+    gb.mmu.writeWord(w, b);
 }
 
 void CPU::CPU_PUSH(const WORD& reg){
-    SP.reg -= 2;
-    mmu.writeWord(SP.reg, reg);
+    regs.SP.reg -= 2;
+    gb.mmu.writeWord(regs.SP.reg, reg);
 }
 
 void CPU::CPU_POP(WORD& reg){
-    reg = mmu.readWord(SP.reg);
-    SP.reg += 2;
+    reg = gb.mmu.readWord(regs.SP.reg);
+    regs.SP.reg += 2;
 }
 
 // 8-bit Arithmetic/Logical Commands
 void CPU::CPU_ADD(const BYTE& b, bool carry){
-    BYTE prev = AF.hi;
-    WORD adding = 0;
-    BYTE carryVal = 0x0;
-    adding += b;
-    if(carry && isFlagged(AF.lo, FLAG_C)){
-        carryVal = 0x1;
-    }
-    AF.hi += adding + carryVal;
-    
-    uint result = prev + adding + carryVal;
-    // Flags
-    AF.lo = 0;
-    if(AF.hi == 0){
-        flagBit(AF.lo, FLAG_Z);
-    }
-    if((prev & 0xF) + (adding & 0xF) + carryVal > 0xF){
-        flagBit(AF.lo, FLAG_HC);
-    }
-    if((result & 0x100) != 0){
-        flagBit(AF.lo, FLAG_C);
-    }
+    BYTE prev = regs.AF.hi;
+    BYTE operand = b;
+    int result = prev + operand + ((carry && carryFlag()) ? 1 : 0);
+    regs.AF.hi = result;
+    setFlags(FLAGS_ADD, prev, operand, regs.AF.hi, result > 0xFF);
 }
 
 void CPU::CPU_SUB(const BYTE& b, bool carry){
-    BYTE prev = AF.hi;
-    BYTE carryVal = 0x0;
-    
-    if(carry && isFlagged(AF.lo, FLAG_C)){
-        carryVal = 0x1;
-    }
-    
-    int subtracting = prev - b - carryVal;
-    BYTE result = static_cast<BYTE>(subtracting);
-    
-    // Flags
-    AF.lo = 0;
-    flagBit(AF.lo, FLAG_N);
-    if(result == 0){
-        flagBit(AF.lo, FLAG_Z);
-    }
-    if(((prev & 0xf) - (b & 0xf) - carryVal) < 0){
-        flagBit(AF.lo, FLAG_HC);
-    }
-    if(subtracting < 0){
-        flagBit(AF.lo, FLAG_C);
-    }
-    
-    AF.hi = result;
+    BYTE prev = regs.AF.hi;
+    BYTE operand = b;
+    int result = prev - operand - ((carry && carryFlag()) ? 1 : 0);
+    regs.AF.hi = result;
+    setFlags(FLAGS_SUB, prev, operand, regs.AF.hi, result < 0);
 }
 
 void CPU::CPU_AND(const BYTE& b){
-    AF.hi &= b;
-    AF.lo = 0;
-    if(AF.hi == 0){
-        flagBit(AF.lo, FLAG_Z);
-    }
-    flagBit(AF.lo, FLAG_HC);
+    regs.AF.hi &= b;
+    setFlags(FLAGS_AND, 0, 0, regs.AF.hi, false);
 }
 
 void CPU::CPU_XOR(const BYTE& b){
-    AF.hi ^= b;
-    AF.lo = 0;
-    if(AF.hi == 0){
-        flagBit(AF.lo, FLAG_Z);
-    }
+    regs.AF.hi ^= b;
+    setFlags(FLAGS_OR, 0, 0, regs.AF.hi, false);
 }
 
 void CPU::CPU_OR(const BYTE& b){
-    AF.hi |= b;
-    AF.lo = 0;
-    if(AF.hi == 0){
-        flagBit(AF.lo, FLAG_Z);
-    }
+    regs.AF.hi |= b;
+    setFlags(FLAGS_OR, 0, 0, regs.AF.hi, false);
 }
 
 void CPU::CPU_CP(const BYTE& b){
-    BYTE regA = AF.hi - b;
-    // Flags
-    AF.lo = 0;
-    flagBit(AF.lo, FLAG_N);
-    if(regA == 0){
-        flagBit(AF.lo, FLAG_Z);
-    }
-    if((AF.hi & 0xF) - (b & 0xF) < 0){
-        flagBit(AF.lo, FLAG_HC);
-    }
-    if(AF.hi < b){
-        flagBit(AF.lo, FLAG_C);
-    }
+    setFlags(FLAGS_SUB, regs.AF.hi, b, regs.AF.hi - b, regs.AF.hi < b);
 }
 
+// INC and DEC leave the carry flag alone
 void CPU::CPU_INC(BYTE& b){
+    BYTE prev = b;
     b++;
-    if(b == 0){
-        flagBit(AF.lo, FLAG_Z);
-    }
-    else{
-        unflagBit(AF.lo, FLAG_Z);
-    }
-    unflagBit(AF.lo, FLAG_N);
-    if((b & 0x0F) == 0x00){
-        flagBit(AF.lo, FLAG_HC);
-    }
-    else{
-        unflagBit(AF.lo, FLAG_HC);
-    }
+    setFlags(FLAGS_ADD, prev, 1, b, carryFlag());
 }
 
 void CPU::CPU_INC_WRITE(){
-    BYTE before = mmu.readByte(HL.reg);
-    before++;
-    mmu.writeByte(HL.reg, before);
-    if(before == 0){
-        flagBit(AF.lo, FLAG_Z);
-    }
-    else{
-        unflagBit(AF.lo, FLAG_Z);
-    }
-    unflagBit(AF.lo, FLAG_N);
-    if((before & 0x0F) == 0x00){
-        flagBit(AF.lo, FLAG_HC);
-    }
-    else{
-        unflagBit(AF.lo, FLAG_HC);
-    }
+    BYTE before = gb.mmu.readByte(regs.HL.reg);
+    gb.mmu.writeByte(regs.HL.reg, before + 1);
+    setFlags(FLAGS_ADD, before, 1, before + 1, carryFlag());
 }
 
 void CPU::CPU_DEC(BYTE& b){
+    BYTE prev = b;
     b--;
-    if(b == 0){
-        flagBit(AF.lo, FLAG_Z);
-    }
-    else{
-        unflagBit(AF.lo, FLAG_Z);
-    }
-    flagBit(AF.lo, FLAG_N);
-    if((b & 0x0F) == 0x0F){
-        flagBit(AF.lo, FLAG_HC);
-    }
-    else{
-        unflagBit(AF.lo, FLAG_HC);
-    }
+    setFlags(FLAGS_SUB, prev, 1, b, carryFlag());
 }
 
 void CPU::CPU_DEC_WRITE(){
-    BYTE before = mmu.readByte(HL.reg);
-    mmu.writeByte(HL.reg, before - 1);
-    if(before - 1 == 0){
-        flagBit(AF.lo, FLAG_Z);
-    }
-    else{
-        unflagBit(AF.lo, FLAG_Z);
-    }
-    flagBit(AF.lo, FLAG_N);
-    if((before - 1 & 0x0F) == 0x0F){
-        flagBit(AF.lo, FLAG_HC);
-    }
-    else{
-        unflagBit(AF.lo, FLAG_HC);
-    }
+    BYTE before = gb.mmu.readByte(regs.HL.reg);
+    gb.mmu.writeByte(regs.HL.reg, before - 1);
+    setFlags(FLAGS_SUB, before, 1, before - 1, carryFlag());
 }
 
 void CPU::CPU_DAA(){
-    if(!isFlagged(AF.lo, FLAG_N)){
-        if(isFlagged(AF.lo, FLAG_C) || AF.hi > 0x99){
-            AF.hi += 0x60;
-            flagBit(AF.lo, FLAG_C);
-        }
-        if(isFlagged(AF.lo, FLAG_HC) || (AF.hi & 0x0F) > 0x09){
-            AF.hi += 0x6;
-        }
-    }
-    else{
-        if(isFlagged(AF.lo, FLAG_C)){
-            AF.hi -= 0x60;
-        }
-        if(isFlagged(AF.lo, FLAG_HC)){
-            AF.hi -= 0x6;
-        }
-    }
-    
-    unflagBit(AF.lo, FLAG_Z);
-    unflagBit(AF.lo, FLAG_HC);
-    
-    if(AF.hi == 0){
-        flagBit(AF.lo, FLAG_Z);
-    }
+    WORD entry = aluTables.daa[(((flags() >> 4) & 0x7) << 8) | regs.AF.hi];
+    regs.AF.hi = entry >> 8;
+    writeFlags(entry & 0xFF);
 }
 
 void CPU::CPU_CPL(){
-    AF.hi = ~AF.hi;
-    flagBit(AF.lo, FLAG_N);
-    flagBit(AF.lo, FLAG_HC);
+    regs.AF.hi = ~regs.AF.hi;
+    flags() |= FLAG_N | FLAG_HC;
 }
 
 // 16-bit Arithmetic/Logical Commands
 void CPU::CPU_ADD_16BIT(WORD& reg, const WORD& val){
-    uint result = reg + val;
+    unsigned int result = reg + val;
     WORD prev = reg;
     reg += val;
+    BYTE& f = flags();
+    f &= FLAG_Z;
     if((prev & 0xFFF) + (val & 0xFFF) > 0xFFF){
-        flagBit(AF.lo, FLAG_HC);
-    }
-    else{
-        unflagBit(AF.lo, FLAG_HC);
+        f |= FLAG_HC;
     }
     if((result & 0x10000) != 0){
-        flagBit(AF.lo, FLAG_C);
+        f |= FLAG_C;
     }
-    else{
-        unflagBit(AF.lo, FLAG_C);
-    }
-    unflagBit(AF.lo, FLAG_N);
 }
 
 void CPU::CPU_ADD_16BIT_SIGNED(WORD& reg, const SIGNED_BYTE& val){
     WORD prev = reg;
     int result = static_cast<int>(prev + val);
-    
-    if(((prev ^ val ^ (result & 0xFFFF)) & 0x10) == 0x10){
-        flagBit(AF.lo, FLAG_HC);
-    }
-    else{
-        unflagBit(AF.lo, FLAG_HC);
-    }
-    if(((prev ^ val ^ (result & 0xFFFF)) & 0x100) == 0x100){
-        flagBit(AF.lo, FLAG_C);
-    }
-    else{
-        unflagBit(AF.lo, FLAG_C);
-    }
-    unflagBit(AF.lo, FLAG_N);
-    unflagBit(AF.lo, FLAG_Z);
-    
+    int carries = prev ^ val ^ (result & 0xFFFF);
+
+    writeFlags(((carries & 0x10) ? FLAG_HC : 0) | ((carries & 0x100) ? FLAG_C : 0));
+
     reg = static_cast<WORD>(result);
 }
 
@@ -288,985 +185,1014 @@ void CPU::CPU_DEC_16BIT(WORD& reg){
     reg--;
 }
 
-void CPU::CPU_RLC(BYTE& reg){
-    bool msb = isFlagged(reg, 0x80);
-    reg <<= 1;
-    AF.lo = 0;
-    if(msb){
-        flagBit(reg, 0x01);
-        flagBit(AF.lo, FLAG_C);
+// Rotate and Shift Commands
+//
+// OP is bits 5-3 of the CB opcode: RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL. RLCA, RRCA,
+// RLA and RRA share the first four. Every flag is written, so pending flags are dropped.
+template<int OP>
+BYTE CPU::CPU_SHIFT(BYTE val){
+    static_assert(OP >= 0 && OP <= 7, "invalid shift");
+    BYTE result;
+    bool carry;
+    if constexpr (OP == 0){
+        carry = val & 0x80;
+        result = (val << 1) | (val >> 7);
+    }
+    else if constexpr (OP == 1){
+        carry = val & 0x01;
+        result = (val >> 1) | (val << 7);
+    }
+    else if constexpr (OP == 2){
+        carry = val & 0x80;
+        result = (val << 1) | (carryFlag() ? 0x01 : 0);
+    }
+    else if constexpr (OP == 3){
+        carry = val & 0x01;
+        result = (val >> 1) | (carryFlag() ? 0x80 : 0);
     }
-    if(reg == 0){
-        flagBit(AF.lo, FLAG_Z);
+    else if constexpr (OP == 4){
+        carry = val & 0x80;
+        result = val << 1;
     }
+    else if constexpr (OP == 5){
+        carry = val & 0x01;
+        result = (val >> 1) | (val & 0x80);
+    }
+    else if constexpr (OP == 6){
+        carry = false;
+        result = (val >> 4) | (val << 4);
+    }
+    else{
+        carry = val & 0x01;
+        result = val >> 1;
+    }
+    writeFlags((result == 0 ? FLAG_Z : 0) | (carry ? FLAG_C : 0));
+    return result;
+}
+
+// 1-bit Operations
+template<int BIT>
+void CPU::CPU_BIT(BYTE val){
+    bool carry = carryFlag();
+    writeFlags((((val >> BIT) & 0x1) ? 0 : FLAG_Z) | FLAG_HC | (carry ? FLAG_C : 0));
+}
+
+template<int BIT>
+BYTE CPU::CPU_SET(BYTE val){
+    return val | (1 << BIT);
+}
+
+template<int BIT>
+BYTE CPU::CPU_RES(BYTE val){
+    return val & ~(1 << BIT);
+}
+
+// CPU Control
+void CPU::CPU_CCF(){
+    BYTE& f = flags();
+    f = (f & FLAG_Z) | (~f & FLAG_C);
 }
 
-void CPU::CPU_RLCA(BYTE& reg){
-    bool msb = isFlagged(reg, 0x80);
-    reg <<= 1;
-    AF.lo = 0;
-    if(msb){
-        flagBit(reg, 0x01);
-        flagBit(AF.lo, FLAG_C);
+void CPU::CPU_SCF(){
+    BYTE& f = flags();
+    f = (f & FLAG_Z) | FLAG_C;
+}
+
+// NOP ignored because we'll handle clock cycle updates in the switch statement
+
+void CPU::CPU_HALT(){
+    if(!regs.IME && regs.pendingInterrupts){
+        regs.halt = false;
+        return;
     }
+    regs.PC--;
+    regs.halt = true;
 }
 
-void CPU::CPU_RL(BYTE& reg){
-    bool msb = isFlagged(reg, 0x80);
-    bool carry = isFlagged(AF.lo, FLAG_C);
-    reg <<= 1;
-    AF.lo = 0;
-    if(msb){
-        flagBit(AF.lo, FLAG_C);
+void CPU::CPU_DI(){
+    regs.IME = false;
+}
+
+void CPU::CPU_EI(){
+    regs.IME = true;
+    regs.exitRequested = true;
+}
+
+// Jump Commands
+void CPU::CPU_JP(bool useFlag, const WORD& address, const BYTE& flag, bool set){
+    if(!useFlag){
+        regs.PC = address;
     }
-    if(carry){
-        flagBit(reg, 0x01);
+    else if(set && isFlagged(flags(), flag)){
+        regs.PC = address;
     }
-    if(reg == 0){
-        flagBit(AF.lo, FLAG_Z);
+    else if(!set && !isFlagged(flags(), flag)){
+        regs.PC = address;
     }
 }
 
-void CPU::CPU_RLA(BYTE& reg){
-    bool msb = isFlagged(reg, 0x80);
-    bool carry = isFlagged(AF.lo, FLAG_C);
-    reg <<= 1;
-    AF.lo = 0;
-    if(msb){
-        flagBit(AF.lo, FLAG_C);
+void CPU::CPU_JR(bool useFlag, const SIGNED_BYTE& address, const BYTE& flag, bool set){
+    if(!useFlag){
+        regs.PC += address;
     }
-    if(carry){
-        flagBit(reg, 0x01);
+    else if(set && isFlagged(flags(), flag)){
+        regs.PC += address;
+    }
+    else if(!set && !isFlagged(flags(), flag)){
+        regs.PC += address;
     }
 }
 
-void CPU::CPU_RRC(BYTE& reg){
-    bool lsb = isFlagged(reg, 0x01);
-    reg >>= 1;
-    AF.lo = 0;
-    if(lsb){
-        flagBit(reg, 0x80);
-        flagBit(AF.lo, FLAG_C);
-    }
-    if(reg == 0){
-        flagBit(AF.lo, FLAG_Z);
+void CPU::CPU_CALL(bool useFlag, const WORD& address, const BYTE& flag, bool set){
+    if(!useFlag || (useFlag && set && isFlagged(flags(), flag)) || (useFlag && !set && !isFlagged(flags(), flag)) ){
+        CPU_PUSH(regs.PC);
+        regs.PC = address;
     }
 }
 
-void CPU::CPU_RR(BYTE& reg){
-    bool lsb = isFlagged(reg, 0x01);
-    bool carry = isFlagged(AF.lo, FLAG_C);
-    reg >>= 1;
-    AF.lo = 0;
-    if(lsb){
-        flagBit(AF.lo, FLAG_C);
+void CPU::CPU_RET(bool useFlag, const BYTE& flag, bool set){
+    if(!useFlag || (useFlag && set && isFlagged(flags(), flag)) || (useFlag && !set && !isFlagged(flags(), flag))){
+        CPU_POP(regs.PC);
     }
-    if(carry){
-        flagBit(reg, 0x80);
+}
+
+void CPU::CPU_RETI(){
+    CPU_RET(0, 0, 0);
+    regs.IME = true;
+    regs.exitRequested = true;
+}
+
+void CPU::CPU_RST(const WORD& address){
+    CPU_CALL(false, address, 0, 0);
+}
+
+void CPU::CPU_RESET(){
+    regs.AF.reg = 0;
+    regs.BC.reg = 0;
+    regs.DE.reg = 0;
+    regs.HL.reg = 0;
+    regs.SP.reg = 0;
+    regs.PC = 0;
+    regs.ifRegister = 0x0;
+    regs.flagOp = FLAGS_NONE;
+    updateInterrupts();
+}
+
+// Opcode dispatch
+//
+// Every opcode gets its own handler, instantiated from CPU::handleOpcode<OPCODE>() and
+// CPU::handleExtendedOpcode<OPCODE>(). The operands are decoded from the opcode bits at
+// compile time (x = bits 7-6, y = bits 5-3, z = bits 2-0), so each handler is a
+// straight-line call into the CPU_* helpers with its registers fixed.
+
+#define FOR_EACH_OPCODE(X) \
+    X(00) X(01) X(02) X(03) X(04) X(05) X(06) X(07) X(08) X(09) X(0A) X(0B) X(0C) X(0D) X(0E) X(0F) \
+    X(10) X(11) X(12) X(13) X(14) X(15) X(16) X(17) X(18) X(19) X(1A) X(1B) X(1C) X(1D) X(1E) X(1F) \
+    X(20) X(21) X(22) X(23) X(24) X(25) X(26) X(27) X(28) X(29) X(2A) X(2B) X(2C) X(2D) X(2E) X(2F) \
+    X(30) X(31) X(32) X(33) X(34) X(35) X(36) X(37) X(38) X(39) X(3A) X(3B) X(3C) X(3D) X(3E) X(3F) \
+    X(40) X(41) X(42) X(43) X(44) X(45) X(46) X(47) X(48) X(49) X(4A) X(4B) X(4C) X(4D) X(4E) X(4F) \
+    X(50) X(51) X(52) X(53) X(54) X(55) X(56) X(57) X(58) X(59) X(5A) X(5B) X(5C) X(5D) X(5E) X(5F) \
+    X(60) X(61) X(62) X(63) X(64) X(65) X(66) X(67) X(68) X(69) X(6A) X(6B) X(6C) X(6D) X(6E) X(6F) \
+    X(70) X(71) X(72) X(73) X(74) X(75) X(76) X(77) X(78) X(79) X(7A) X(7B) X(7C) X(7D) X(7E) X(7F) \
+    X(80) X(81) X(82) X(83) X(84) X(85) X(86) X(87) X(88) X(89) X(8A) X(8B) X(8C) X(8D) X(8E) X(8F) \
+    X(90) X(91) X(92) X(93) X(94) X(95) X(96) X(97) X(98) X(99) X(9A) X(9B) X(9C) X(9D) X(9E) X(9F) \
+    X(A0) X(A1) X(A2) X(A3) X(A4) X(A5) X(A6) X(A7) X(A8) X(A9) X(AA) X(AB) X(AC) X(AD) X(AE) X(AF) \
+    X(B0) X(B1) X(B2) X(B3) X(B4) X(B5) X(B6) X(B7) X(B8) X(B9) X(BA) X(BB) X(BC) X(BD) X(BE) X(BF) \
+    X(C0) X(C1) X(C2) X(C3) X(C4) X(C5) X(C6) X(C7) X(C8) X(C9) X(CA) X(CB) X(CC) X(CD) X(CE) X(CF) \
+    X(D0) X(D1) X(D2) X(D3) X(D4) X(D5) X(D6) X(D7) X(D8) X(D9) X(DA) X(DB) X(DC) X(DD) X(DE) X(DF) \
+    X(E0) X(E1) X(E2) X(E3) X(E4) X(E5) X(E6) X(E7) X(E8) X(E9) X(EA) X(EB) X(EC) X(ED) X(EE) X(EF) \
+    X(F0) X(F1) X(F2) X(F3) X(F4) X(F5) X(F6) X(F7) X(F8) X(F9) X(FA) X(FB) X(FC) X(FD) X(FE) X(FF)
+
+// 8-bit registers in opcode encoding order: B, C, D, E, H, L, (HL), A
+template<int R>
+inline BYTE& CPU::reg8(){
+    static_assert(R >= 0 && R <= 7 && R != 6, "(HL) is not a register");
+    return regs.r8[registerIndex(R)];
+}
+
+// 16-bit register pairs in opcode encoding order: BC, DE, HL, SP
+template<int P>
+inline WORD& CPU::reg16(){
+    static_assert(P >= 0 && P <= 3, "invalid register pair");
+    if constexpr (P == 3){
+        return regs.SP.reg;
     }
-    if(reg == 0){
-        flagBit(AF.lo, FLAG_Z);
+    else{
+        return regs.r16[P];
     }
 }
 
-void CPU::CPU_RRCA(BYTE& reg){
-    bool lsb = isFlagged(reg, 0x01);
-    reg >>= 1;
-    AF.lo = 0;
-    if(lsb){
-        flagBit(reg, 0x80);
-        flagBit(AF.lo, FLAG_C);
-    }
+// Register pairs used by PUSH/POP: BC, DE, HL, AF
+template<int P>
+inline WORD& CPU::stackReg16(){
+    static_assert(P >= 0 && P <= 3, "invalid register pair");
+    return regs.r16[P];
 }
 
-void CPU::CPU_RRA(BYTE& reg){
-    bool lsb = isFlagged(reg, 0x01);
-    bool carry = isFlagged(AF.lo, FLAG_C);
-    reg >>= 1;
-    AF.lo = 0;
-    if(lsb){
-        flagBit(AF.lo, FLAG_C);
+// Source operand of an 8-bit instruction, (HL) goes through memory
+template<int R>
+inline BYTE CPU::readOperand(){
+    if constexpr (R == 6){
+        return gb.mmu.readByte(regs.HL.reg);
     }
-    if(carry){
-        flagBit(reg, 0x80);
+    else{
+        return reg8<R>();
     }
 }
 
-void CPU::CPU_RLC_WRITE(){
-    BYTE reg = mmu.readByte(HL.reg);
-    bool msb = isFlagged(reg, 0x80);
-    reg <<= 1;
-    AF.lo = 0;
-    if(msb){
-        flagBit(AF.lo, FLAG_C);
-        flagBit(reg, 0x01);
+// Destination operand of an 8-bit instruction, (HL) goes through memory
+template<int R>
+inline void CPU::writeOperand(BYTE val){
+    if constexpr (R == 6){
+        gb.mmu.writeByte(regs.HL.reg, val);
     }
-    mmu.writeByte(HL.reg, reg);
-    if(reg == 0){
-        flagBit(AF.lo, FLAG_Z);
+    else{
+        reg8<R>() = val;
     }
 }
 
-void CPU::CPU_RL_WRITE(){
-    BYTE reg = mmu.readByte(HL.reg);
-    bool msb = isFlagged(reg, 0x80);
-    bool carry = isFlagged(AF.lo, FLAG_C);
-    reg <<= 1;
-    AF.lo = 0;
-    if(msb){
-        flagBit(AF.lo, FLAG_C);
+// Condition codes in opcode encoding order: NZ, Z, NC, C
+#define CONDITION_FLAG(cc) ((cc) < 2 ? FLAG_Z : FLAG_C)
+#define CONDITION_SET(cc) (((cc) & 1) != 0)
+
+// (HL) operands are read and written back through the same memory path as registers
+template<BYTE OPCODE>
+int CPU::handleExtendedOpcode(WORD){
+    constexpr int x = OPCODE >> 6;
+    constexpr int y = (OPCODE >> 3) & 0x7;
+    constexpr int z = OPCODE & 0x7;
+    
+    BYTE val = readOperand<z>();
+    if constexpr (x == 0){
+        writeOperand<z>(CPU_SHIFT<y>(val));
     }
-    if(carry){
-        flagBit(reg, 0x01);
+    else if constexpr (x == 1){
+        CPU_BIT<y>(val);
     }
-    mmu.writeByte(HL.reg, reg);
-    if(reg == 0){
-        flagBit(AF.lo, FLAG_Z);
+    else if constexpr (x == 2){
+        writeOperand<z>(CPU_RES<y>(val));
     }
-}
-
-void CPU::CPU_RRC_WRITE(){
-    BYTE reg = mmu.readByte(HL.reg);
-    bool lsb = isFlagged(reg, 0x01);
-    reg >>= 1;
-    AF.lo = 0;
-    if(lsb){
-        flagBit(AF.lo, FLAG_C);
-        flagBit(reg, 0x80);
+    else{
+        writeOperand<z>(CPU_SET<y>(val));
+    }
+    return extendedOpcodeInfo[OPCODE].cycles;
+}
+
+template<BYTE OPCODE>
+int CPU::handleOpcode(WORD operand){
+    constexpr int x = OPCODE >> 6;
+    constexpr int y = (OPCODE >> 3) & 0x7;
+    constexpr int z = OPCODE & 0x7;
+    constexpr int p = y >> 1;
+    constexpr int q = y & 0x1;
+    constexpr const OpcodeInfo& info = opcodeInfo[OPCODE];
+
+    // 8-Bit Loads
+    if constexpr (OPCODE == 0x76){
+        CPU_HALT();
+        if(!regs.halt){
+            // HALT bug, the next byte is read twice: as the opcode and again as what follows it
+            DecodedInstruction instruction = decode(regs.PC, regs.PC);
+            regs.PC += instruction.length - 1;
+            return info.cycles + execute(instruction);
+        }
+        return info.cycles;
     }
-    mmu.writeByte(HL.reg, reg);
-    if(reg == 0){
-        flagBit(AF.lo, FLAG_Z);
+    else if constexpr (x == 1 && y == 6){
+        CPU_LOAD_WRITE(regs.HL.reg, reg8<z>());
+        return info.cycles;
     }
-}
-
-void CPU::CPU_RR_WRITE(){
-    BYTE reg = mmu.readByte(HL.reg);
-    bool lsb = isFlagged(reg, 0x01);
-    bool carry = isFlagged(AF.lo, FLAG_C);
-    reg >>= 1;
-    AF.lo = 0;
-    if(lsb){
-        flagBit(AF.lo, FLAG_C);
+    else if constexpr (x == 1){
+        CPU_LOAD(reg8<y>(), readOperand<z>());
+        return info.cycles;
     }
-    if(carry){
-        flagBit(reg, 0x80);
+    else if constexpr (x == 0 && z == 6 && y == 6){
+        CPU_LOAD_WRITE(regs.HL.reg, (BYTE) operand);
+        return info.cycles;
     }
-    mmu.writeByte(HL.reg, reg);
-    if(reg == 0){
-        flagBit(AF.lo, FLAG_Z);
+    else if constexpr (x == 0 && z == 6){
+        CPU_LOAD(reg8<y>(), (BYTE) operand);
+        return info.cycles;
     }
-}
-
-void CPU::CPU_SLA(BYTE& reg){
-    bool msb = isFlagged(reg, 0x80);
-    reg <<= 1;
-    AF.lo = 0;
-    if(msb){
-        flagBit(AF.lo, FLAG_C);
+    else if constexpr (x == 0 && z == 2){
+        // (BC), (DE), (HL+), (HL-)
+        WORD address = p == 0 ? regs.BC.reg : p == 1 ? regs.DE.reg : p == 2 ? regs.HL.reg++ : regs.HL.reg--;
+        if constexpr (q == 0){
+            CPU_LOAD_WRITE(address, regs.AF.hi);
+        }
+        else{
+            CPU_LOAD(regs.AF.hi, gb.mmu.readByte(address));
+        }
+        return info.cycles;
     }
-    if(reg == 0){
-        flagBit(AF.lo, FLAG_Z);
+    else if constexpr (OPCODE == 0xFA){
+        CPU_LOAD(regs.AF.hi, gb.mmu.readByte(operand));
+        return info.cycles;
     }
-}
-
-void CPU::CPU_SLA_WRITE(){
-    BYTE reg = mmu.readByte(HL.reg);
-    bool msb = isFlagged(reg, 0x80);
-    reg <<= 1;
-    mmu.writeByte(HL.reg, reg);
-    AF.lo = 0;
-    if(msb){
-        flagBit(AF.lo, FLAG_C);
+    else if constexpr (OPCODE == 0xEA){
+        CPU_LOAD_WRITE(operand, regs.AF.hi);
+        return info.cycles;
     }
-    if(reg == 0){
-        flagBit(AF.lo, FLAG_Z);
+    else if constexpr (OPCODE == 0x08){
+        CPU_LOAD_WRITE_16BIT(operand, regs.SP.reg);
+        return info.cycles;
     }
-}
-
-void CPU::CPU_SWAP(BYTE& reg){
-    reg = (reg >> 4) | (reg << 4);
-    AF.lo = 0;
-    if(reg == 0){
-        flagBit(AF.lo, FLAG_Z);
+    else if constexpr (OPCODE == 0xF0){
+        CPU_LOAD(regs.AF.hi, gb.mmu.readByte(0xFF00 + (BYTE) operand));
+        return info.cycles;
     }
-}
-
-void CPU::CPU_SWAP_WRITE(){
-    BYTE reg = mmu.readByte(HL.reg);
-    reg = (reg >> 4) | (reg << 4);
-    mmu.writeByte(HL.reg, reg);
-    AF.lo = 0;
-    if(reg == 0){
-        flagBit(AF.lo, FLAG_Z);
+    else if constexpr (OPCODE == 0xE0){
+        CPU_LOAD_WRITE(0xFF00 + (BYTE) operand, regs.AF.hi);
+        return info.cycles;
     }
-}
-
-void CPU::CPU_SRA(BYTE& reg){
-    bool msb = isFlagged(reg, 0x80);
-    bool carryBit = isFlagged(reg, 0x1);
-    reg >>= 1;
-    AF.lo = 0;
-    if(msb){
-        flagBit(reg, 0x80);
+    else if constexpr (OPCODE == 0xF2){
+        CPU_LOAD(regs.AF.hi, gb.mmu.readByte(0xFF00 + regs.BC.lo));
+        return info.cycles;
     }
-    if(carryBit){
-        flagBit(AF.lo, FLAG_C);
+    else if constexpr (OPCODE == 0xE2){
+        CPU_LOAD_WRITE(0xFF00 + regs.BC.lo, regs.AF.hi);
+        return info.cycles;
     }
-    if(reg == 0){
-        flagBit(AF.lo, FLAG_Z);
+    // 16-Bit Loads
+    else if constexpr (x == 0 && z == 1 && q == 0){
+        CPU_LOAD_16BIT(reg16<p>(), operand, 0, false);
+        return info.cycles;
     }
-}
-
-void CPU::CPU_SRA_WRITE(){
-    BYTE reg = mmu.readByte(HL.reg);
-    bool msb = isFlagged(reg, 0x80);
-    bool carryBit = isFlagged(reg, 0x1);
-    reg >>= 1;
-    
-    AF.lo = 0;
-    if(msb){
-        flagBit(reg, 0x80);
+    else if constexpr (OPCODE == 0xF9){
+        CPU_LOAD_16BIT(regs.SP.reg, regs.HL.reg, 0, false);
+        return info.cycles;
     }
-    if(carryBit){
-        flagBit(AF.lo, FLAG_C);
+    else if constexpr (x == 3 && z == 5 && q == 0){
+        if constexpr (p == 3){
+            materialiseFlags();
+        }
+        CPU_PUSH(stackReg16<p>());
+        return info.cycles;
+    }
+    else if constexpr (x == 3 && z == 1 && q == 0){
+        CPU_POP(stackReg16<p>());
+        if constexpr (p == 3){
+            // The low nibble of F always reads back as zero
+            writeFlags(regs.AF.lo & 0xF0);
+        }
+        return info.cycles;
     }
-    mmu.writeByte(HL.reg, reg);
-    if(reg == 0){
-        flagBit(AF.lo, FLAG_Z);
+    // 8-Bit Arithmetic
+    else if constexpr (x == 2 || (x == 3 && z == 6)){
+        BYTE val;
+        if constexpr (x == 3){
+            val = (BYTE) operand;
+        }
+        else{
+            val = readOperand<z>();
+        }
+        switch(y){
+            case 0: CPU_ADD(val, false); break;
+            case 1: CPU_ADD(val, true); break;
+            case 2: CPU_SUB(val, false); break;
+            case 3: CPU_SUB(val, true); break;
+            case 4: CPU_AND(val); break;
+            case 5: CPU_XOR(val); break;
+            case 6: CPU_OR(val); break;
+            case 7: CPU_CP(val); break;
+        }
+        return info.cycles;
     }
-}
-
-void CPU::CPU_SRL(BYTE& reg){
-    bool msb = isFlagged(reg, 0x1);
-    reg >>= 1;
-    AF.lo = 0;
-    if(msb){
-        flagBit(AF.lo, FLAG_C);
+    else if constexpr (x == 0 && z == 4){
+        if constexpr (y == 6){
+            CPU_INC_WRITE();
+            return info.cycles;
+        }
+        else{
+            CPU_INC(reg8<y>());
+            return info.cycles;
+        }
     }
-    if(reg == 0){
-        flagBit(AF.lo, FLAG_Z);
+    else if constexpr (x == 0 && z == 5){
+        if constexpr (y == 6){
+            CPU_DEC_WRITE();
+            return info.cycles;
+        }
+        else{
+            CPU_DEC(reg8<y>());
+            return info.cycles;
+        }
     }
-}
-
-void CPU::CPU_SRL_WRITE(){
-    BYTE reg = mmu.readByte(HL.reg);
-    bool msb = isFlagged(reg, 0x1);
-    reg >>= 1;
-    mmu.writeByte(HL.reg, reg);
-    AF.lo = 0;
-    if(msb){
-        flagBit(AF.lo, FLAG_C);
+    else if constexpr (OPCODE == 0x27){
+        CPU_DAA();
+        return info.cycles;
+    }
+    else if constexpr (OPCODE == 0x2F){
+        CPU_CPL();
+        return info.cycles;
+    }
+    // 16-Bit Arithmetic/Logical Commands
+    else if constexpr (x == 0 && z == 1){
+        CPU_ADD_16BIT(regs.HL.reg, reg16<p>());
+        return info.cycles;
+    }
+    else if constexpr (x == 0 && z == 3 && q == 0){
+        CPU_INC_16BIT(reg16<p>());
+        return info.cycles;
+    }
+    else if constexpr (x == 0 && z == 3){
+        CPU_DEC_16BIT(reg16<p>());
+        return info.cycles;
+    }
+    else if constexpr (OPCODE == 0xE8){
+        CPU_ADD_16BIT_SIGNED(regs.SP.reg, (SIGNED_BYTE) operand);
+        return info.cycles;
+    }
+    else if constexpr (OPCODE == 0xF8){
+        CPU_LOAD_16BIT(regs.HL.reg, regs.SP.reg, (SIGNED_BYTE) operand, true);
+        return info.cycles;
+    }
+    // Rotate and Shift Commands: RLCA, RRCA, RLA, RRA always clear Z
+    else if constexpr (x == 0 && z == 7 && y < 4){
+        regs.AF.hi = CPU_SHIFT<y>(regs.AF.hi);
+        regs.AF.lo &= FLAG_C;
+        return info.cycles;
+    }
+    // Includes the rotate/shift + 1-bit operations. Decoding goes straight to their own
+    // handlers, this only forwards to them.
+    else if constexpr (OPCODE == 0xCB){
+        return execute(decodeInstruction(OPCODE, (BYTE) operand, 0));
+    }
+    // CPU-Control Commands
+    else if constexpr (OPCODE == 0x3F){
+        CPU_CCF();
+        return info.cycles;
+    }
+    else if constexpr (OPCODE == 0x37){
+        CPU_SCF();
+        return info.cycles;
+    }
+    else if constexpr (OPCODE == 0x00 || OPCODE == 0x10){
+        return info.cycles;
+    }
+    else if constexpr (OPCODE == 0xF3){
+        CPU_DI();
+        return info.cycles;
+    }
+    else if constexpr (OPCODE == 0xFB){
+        CPU_EI();
+        return info.cycles;
+    }
+    // Jump Commands
+    else if constexpr (OPCODE == 0xC3){
+        CPU_JP(0, operand, 0, 0);
+        return info.cycles;
+    }
+    else if constexpr (OPCODE == 0xE9){
+        CPU_JP(0, regs.HL.reg, 0, 0);
+        return info.cycles;
+    }
+    else if constexpr (x == 3 && z == 2 && y < 4){
+        CPU_JP(1, operand, CONDITION_FLAG(y), CONDITION_SET(y));
+        return isFlagged(flags(), CONDITION_FLAG(y)) == CONDITION_SET(y) ? info.takenCycles : info.cycles;
+    }
+    else if constexpr (OPCODE == 0x18){
+        CPU_JR(0, (SIGNED_BYTE) operand, 0, 0);
+        return info.cycles;
+    }
+    else if constexpr (x == 0 && z == 0 && y >= 4){
+        CPU_JR(1, (SIGNED_BYTE) operand, CONDITION_FLAG(y - 4), CONDITION_SET(y - 4));
+        return isFlagged(flags(), CONDITION_FLAG(y - 4)) == CONDITION_SET(y - 4) ? info.takenCycles : info.cycles;
+    }
+    else if constexpr (OPCODE == 0xCD){
+        CPU_CALL(0, operand, 0, 0);
+        return info.cycles;
+    }
+    else if constexpr (x == 3 && z == 4 && y < 4){
+        CPU_CALL(1, operand, CONDITION_FLAG(y), CONDITION_SET(y));
+        return isFlagged(flags(), CONDITION_FLAG(y)) == CONDITION_SET(y) ? info.takenCycles : info.cycles;
+    }
+    else if constexpr (OPCODE == 0xC9){
+        CPU_RET(0, 0, 0);
+        return info.cycles;
     }
-    if(reg == 0){
-        flagBit(AF.lo, FLAG_Z);
+    else if constexpr (x == 3 && z == 0 && y < 4){
+        CPU_RET(1, CONDITION_FLAG(y), CONDITION_SET(y));
+        return isFlagged(flags(), CONDITION_FLAG(y)) == CONDITION_SET(y) ? info.takenCycles : info.cycles;
+    }
+    else if constexpr (OPCODE == 0xD9){
+        CPU_RETI();
+        return info.cycles;
+    }
+    else if constexpr (x == 3 && z == 7){
+        CPU_RST(y * 8);
+        return info.cycles;
+    }
+    // 0xD3, 0xDB, 0xDD, 0xE3, 0xE4, 0xEB, 0xEC, 0xED, 0xF4, 0xFC, 0xFD
+    else{
+        assert(false);
+        return info.cycles;
     }
 }
 
-// 1-bit Operations
-void CPU::CPU_BIT(const BYTE& bit, const BYTE& reg){
-    WORD mask = 256;
-    if(((mask >> (8 - bit)) & 0xFF & reg) == 0){
-        flagBit(AF.lo, FLAG_Z);
+// Either handler, by DecodedInstruction::handler
+template<WORD HANDLER>
+inline int CPU::handle(WORD operand){
+    if constexpr (HANDLER < 0x100){
+        return handleOpcode<HANDLER>(operand);
     }
     else{
-        unflagBit(AF.lo, FLAG_Z);
+        return handleExtendedOpcode<HANDLER & 0xFF>(operand);
+    }
+}
+
+// Superinstructions
+//
+// The pairs in fusions.hpp each run from one dispatch, with both handlers inlined into
+// one. The second half only runs where the batch would have gone straight on to it, or
+// where stopping first would change nothing: not at the start of a polling loop being
+// watched and not once the deadline's reached. An I/O access ends a batch so runFrame()
+// can take an interrupt or bring the deadline forward, so after one a second half that
+// touches no memory still runs unless either has happened. A first half that may write,
+// the stack included, could have switched banks, so after an I/O access in one of those
+// the second half's left to run on its own. It sees the same clock and registers either
+// way. Each half still records its own lazy flags, though in the pairs picked so far at
+// most one of them sets any.
+template<WORD FIRST, WORD SECOND>
+int CPU::handleFused(WORD operand){
+    constexpr const OpcodeInfo& firstInfo = FIRST < 0x100 ? opcodeInfo[FIRST] : extendedOpcodeInfo[FIRST & 0xFF];
+    constexpr const OpcodeInfo& info = SECOND < 0x100 ? opcodeInfo[SECOND] : extendedOpcodeInfo[SECOND & 0xFF];
+    constexpr bool carriesOn = info.memory == MEMORY_NONE && (firstInfo.memory == MEMORY_NONE || firstInfo.memory == MEMORY_READ);
+    
+    int firstCycles = handle<FIRST>(operand);
+    uint64_t end = gb.scheduler.now + regs.pendingCycles + firstCycles;
+    if(regs.PC == pollLoopStart || end >= batchDeadline){
+        return firstCycles;
+    }
+    if(regs.exitRequested && (!carriesOn || (regs.IME && regs.pendingInterrupts) || end >= gb.scheduler.nextEvent())){
+        return firstCycles;
     }
-    unflagBit(AF.lo, FLAG_N);
-    flagBit(AF.lo, FLAG_HC);
+    
+    // The second half's operand is in its own predecoded instruction
+    WORD secondOperand = 0;
+    if constexpr (info.operand != OPERAND_NONE){
+        secondOperand = fetch().operand;
+    }
+    fusedSecondPC = regs.PC;
+    regs.PC += info.length;
+    
+    // What's returned is added to pendingCycles once both have run, but an I/O access in
+    // the second half has to see the first's cycles
+    regs.pendingCycles += firstCycles;
+    int cycles = firstCycles + handle<SECOND>(secondOperand);
+    regs.pendingCycles -= firstCycles;
+    return cycles;
 }
 
-void CPU::CPU_SET(const BYTE& bit, BYTE& reg){
-    WORD mask = 256;
-    reg = ((mask >> (8 - bit)) & 0xFF) | reg;
+#define OPCODE_HANDLER(n) &CPU::handleOpcode<0x##n>,
+#define EXTENDED_OPCODE_HANDLER(n) &CPU::handleExtendedOpcode<0x##n>,
+#define FUSED_HANDLER(first, second) &CPU::handleFused<first, second>,
+
+// Indexed by DecodedInstruction::handler, or 0x1FF + DecodedInstruction::fusion
+const CPU::OpcodeHandler CPU::handlerTable[512 + FUSION_COUNT] = {
+    FOR_EACH_OPCODE(OPCODE_HANDLER)
+    FOR_EACH_OPCODE(EXTENDED_OPCODE_HANDLER)
+    FOR_EACH_FUSION(FUSED_HANDLER)
+};
+
+#undef OPCODE_HANDLER
+#undef EXTENDED_OPCODE_HANDLER
+#undef FUSED_HANDLER
+
+#ifdef GB_JIT_ENABLED
+
+template<BYTE OPCODE>
+int CPU::compiledOpcode(CPU& cpu, WORD operand){
+    return cpu.handleOpcode<OPCODE>(operand);
 }
 
-void CPU::CPU_SET_WRITE(const BYTE& bit){
-    BYTE reg = mmu.readByte(HL.reg);
-    WORD mask = 256;
-    reg = ((mask >> (8 - bit)) & 0xFF) | reg;
-    mmu.writeByte(HL.reg, reg);
+template<BYTE OPCODE>
+int CPU::compiledExtendedOpcode(CPU& cpu, WORD operand){
+    return cpu.handleExtendedOpcode<OPCODE>(operand);
 }
 
-void CPU::CPU_RES(const BYTE& bit, BYTE& reg){
-    WORD mask = 256;
-    reg = ~((mask >> (8 - bit)) & 0xFF) & reg;
+#define COMPILED_OPCODE_HANDLER(n) &CPU::compiledOpcode<0x##n>,
+#define COMPILED_EXTENDED_OPCODE_HANDLER(n) &CPU::compiledExtendedOpcode<0x##n>,
+
+const CompiledHandler CPU::compiledHandlerTable[512] = {
+    FOR_EACH_OPCODE(COMPILED_OPCODE_HANDLER)
+    FOR_EACH_OPCODE(COMPILED_EXTENDED_OPCODE_HANDLER)
+};
+
+#undef COMPILED_OPCODE_HANDLER
+#undef COMPILED_EXTENDED_OPCODE_HANDLER
+
+#endif
+
+#if defined(GB_THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+
+// Computed-goto build: one indirect jump per instruction, with every handler
+// inlined into its own label instead of being called through the table.
+#define OPCODE_LABEL(n) &&opcode_##n,
+#define OPCODE_BODY(n) opcode_##n: return handleOpcode<0x##n>(instruction.operand);
+#define EXTENDED_OPCODE_LABEL(n) &&extended_##n,
+#define EXTENDED_OPCODE_BODY(n) extended_##n: return handleExtendedOpcode<0x##n>(instruction.operand);
+#define FUSED_LABEL(first, second) &&fused_##first##_##second,
+#define FUSED_BODY(first, second) fused_##first##_##second: return handleFused<first, second>(instruction.operand);
+
+int CPU::execute(const DecodedInstruction& instruction){
+    static void* const labels[512 + FUSION_COUNT] = {
+        FOR_EACH_OPCODE(OPCODE_LABEL)
+        FOR_EACH_OPCODE(EXTENDED_OPCODE_LABEL)
+        FOR_EACH_FUSION(FUSED_LABEL)
+    };
+    goto *labels[instruction.fusion ? 0x1FF + instruction.fusion : instruction.handler];
+    FOR_EACH_OPCODE(OPCODE_BODY)
+    FOR_EACH_OPCODE(EXTENDED_OPCODE_BODY)
+    FOR_EACH_FUSION(FUSED_BODY)
 }
 
-void CPU::CPU_RES_WRITE(const BYTE& bit){
-    BYTE reg = mmu.readByte(HL.reg);
-    WORD mask = 256;
-    reg = ~((mask >> (8 - bit)) & 0xFF) & reg;
-    mmu.writeByte(HL.reg, reg);
+#undef OPCODE_LABEL
+#undef OPCODE_BODY
+#undef EXTENDED_OPCODE_LABEL
+#undef EXTENDED_OPCODE_BODY
+#undef FUSED_LABEL
+#undef FUSED_BODY
+
+#else
+
+int CPU::execute(const DecodedInstruction& instruction){
+    int handler = instruction.fusion ? 0x1FF + instruction.fusion : instruction.handler;
+    return (this->*handlerTable[handler])(instruction.operand);
 }
 
-// CPU Control
-void CPU::CPU_CCF(){
-    unflagBit(AF.lo, FLAG_N);
-    unflagBit(AF.lo, FLAG_HC);
-    if(isFlagged(AF.lo, FLAG_C)){
-        unflagBit(AF.lo, FLAG_C);
-    }
-    else{
-        flagBit(AF.lo, FLAG_C);
+#endif
+
+// Reads only as many bytes as the instruction has, any of them may be an I/O register
+DecodedInstruction CPU::decode(WORD opcodeAddress, WORD operandAddress){
+    BYTE opcode = gb.mmu.readByte(opcodeAddress);
+    int length = opcode == 0xCB ? 2 : opcodeInfo[opcode].length;
+    BYTE byte1 = length > 1 ? gb.mmu.readByte(operandAddress) : 0;
+    BYTE byte2 = length > 2 ? gb.mmu.readByte(operandAddress + 1) : 0;
+    return decodeInstruction(opcode, byte1, byte2);
+}
+
+// ROM is run from its predecoded instructions. Anything else, RAM or the boot ROM, is
+// decoded as it runs, so there's nothing to go stale when it's written.
+inline DecodedInstruction CPU::fetch(){
+    const DecodedInstruction* page = gb.mmu.decodedPage(regs.PC);
+    if(page && page[regs.PC & 0xFF].length){
+        return page[regs.PC & 0xFF];
     }
+    return decode(regs.PC, regs.PC + 1);
 }
 
-void CPU::CPU_SCF(){
-    unflagBit(AF.lo, FLAG_N);
-    unflagBit(AF.lo, FLAG_HC);
-    flagBit(AF.lo, FLAG_C);
+// One instruction, never a superinstruction
+inline int CPU::executeNext(){
+    DecodedInstruction instruction = fetch();
+    instruction.fusion = 0;
+    regs.PC += instruction.length;
+    return execute(instruction);
 }
 
-// NOP ignored because we'll handle clock cycle updates in the switch statement
 
-void CPU::CPU_HALT(){
-    if(!IME && (ifRegister & ieRegister & 0x1F)){
-        halt = false;
+void CPU::reset(){
+    CPU_RESET();
+    
+    gb.mmu.mapIO(0xFF0F, [](GameBoy& gb, WORD){ return (BYTE) gb.cpu.regs.ifRegister; },
+                         [](GameBoy& gb, WORD, BYTE val){
+                             gb.cpu.regs.ifRegister = 0x1F & val;
+                             gb.cpu.updateInterrupts();
+                             gb.ppu.requestStep();
+                         });
+    gb.mmu.mapIO(0xFFFF, [](GameBoy& gb, WORD){ return (BYTE) gb.cpu.regs.ieRegister; },
+                         [](GameBoy& gb, WORD, BYTE val){
+                             gb.cpu.regs.ieRegister = val;
+                             gb.cpu.updateInterrupts();
+                         });
+}
+
+// Interrupt bit serviced first for each IF & IE, the lowest one set
+static constexpr BYTE firstInterrupt[32] = {
+    0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0
+};
+
+void CPU::handleInterrupts(){
+    
+    // Nothing both requested and enabled
+    if(!regs.pendingInterrupts){
+        return;
+    }
+    
+    if(regs.halt){
+        regs.PC++;
+        regs.halt = false;
+    }
+    
+    if(!regs.IME){
         return;
     }
-    PC--;
-    halt = true;
+    
+    // V-blank, LCD STAT, timer, serial and joypad at 0x40, 0x48, 0x50, 0x58 and 0x60
+    int interrupt = firstInterrupt[regs.pendingInterrupts];
+    regs.IME = false;
+    regs.ifRegister &= ~(1 << interrupt);
+    updateInterrupts();
+    
+    // The LY = LYC interrupt can be requested again straight away
+    if(interrupt == 1){
+        gb.ppu.requestStep();
+    }
+    CPU_RST(0x0040 + interrupt * 8);
 }
 
-void CPU::CPU_DI(){
-    IME = false;
+void CPU::requestInterrupt(BYTE interrupt){
+    regs.ifRegister |= interrupt;
+    updateInterrupts();
 }
 
-void CPU::CPU_EI(){
-    IME = true;
+void CPU::updateInterrupts(){
+    regs.pendingInterrupts = regs.ifRegister & regs.ieRegister & 0x1F;
 }
 
-// Jump Commands
-void CPU::CPU_JP(bool useFlag, const WORD& address, const BYTE& flag, bool set){
-    if(!useFlag){
-        PC = address;
-    }
-    else if(set && isFlagged(AF.lo, flag)){
-        PC = address;
-    }
-    else if(!set && !isFlagged(AF.lo, flag)){
-        PC = address;
+int CPU::step(){
+    return executeNext();
+}
+
+// Batch execution
+//
+// Instructions run back to back without the master clock being moved in between. The
+// caller picks a deadline no later than the next scheduled event, so no event runs
+// late. The batch also ends early on anything that can make an interrupt serviceable:
+// an I/O access (IF, IE or a device register) or EI/RETI. The clock is brought up to
+// date before every I/O access, so the CPU sees the same register values it would have
+// if it were moved after each instruction.
+//
+// A halted CPU re-runs HALT until handleInterrupts() sees an interrupt, and nothing it
+// can see changes mid-batch, so the rest of the batch is skipped in one go. Polling
+// loops are skipped up to the deadline in whole iterations, see CPU::skipPollLoop().
+int CPU::runUntil(uint64_t cycleDeadline){
+    int cycles = 0;
+    regs.exitRequested = false;
+    batchDeadline = cycleDeadline;
+#ifdef GB_JIT_ENABLED
+    bool atBlockStart = true;
+    uncompiledPC = 0xFFFF;
+#endif
+    
+    while(gb.scheduler.now + regs.pendingCycles < cycleDeadline && !regs.exitRequested){
+        
+        // Halted with nothing pending, so every instruction up to the deadline is this HALT again
+        if(regs.halt){
+            int haltCycles = opcodeInfo[0x76].cycles;
+            int remaining = (int) (cycleDeadline - (gb.scheduler.now + regs.pendingCycles));
+            int clockCycles = (remaining + haltCycles - 1) / haltCycles * haltCycles;
+            cycles += clockCycles;
+            regs.pendingCycles += clockCycles;
+            break;
+        }
+        
+        if(regs.PC == pollLoopStart){
+            int clockCycles = skipPollLoop(cycleDeadline);
+            cycles += clockCycles;
+            regs.pendingCycles += clockCycles;
+            if(gb.scheduler.now + regs.pendingCycles >= cycleDeadline){
+                break;
+            }
+        }
+        
+#ifdef GB_JIT_ENABLED
+        if(atBlockStart && regs.PC != uncompiledPC && runsCompiled){
+            int blockCycles;
+            if(runCompiled(cycleDeadline, blockCycles)){
+                cycles += blockCycles;
+                continue;
+            }
+        }
+#endif
+        
+        WORD instructionPC = regs.PC;
+        DecodedInstruction instruction = fetch();
+#ifdef GB_PAIR_PROFILE
+        countPair(instructionPC, instruction);
+#endif
+        regs.PC += instruction.length;
+        int clockCycles = execute(instruction);
+        cycles += clockCycles;
+        regs.pendingCycles += clockCycles;
+        
+        // Both halves of a superinstruction ran, and only the second can have jumped
+        if(instruction.fusion && fusedSecondPC != 0xFFFF){
+            instructionPC = fusedSecondPC;
+            instruction.handler = fusions[instruction.fusion].second;
+            instruction.length = instructionInfo(instruction).length;
+            fusedSecondPC = 0xFFFF;
+        }
+        
+        if(regs.PC < instructionPC && instructionPC - regs.PC < POLL_LOOP_LENGTH){
+            watchPollLoop(regs.PC, instructionPC);
+        }
+#ifdef GB_JIT_ENABLED
+        // Anywhere but the next instruction may be the start of a block
+        atBlockStart = regs.PC != (WORD) (instructionPC + instruction.length);
+#endif
     }
+    
+    syncDevices();
+    return cycles;
 }
 
-void CPU::CPU_JR(bool useFlag, const SIGNED_BYTE& address, const BYTE& flag, bool set){
-    if(!useFlag){
-        PC += address;
+#ifdef GB_JIT_ENABLED
+
+// Tiered execution
+//
+// The interpreter counts jumps to each block start in ROM, and once one is hot the block is
+// compiled, see JIT. A compiled block runs in place of the interpreter when the deadline
+// can't fall inside it, so every instruction it runs the interpreter would have run too.
+// It stops early after an I/O access or bank switch, the same as a batch would, and isn't
+// run across the start of a polling loop being watched so the loop is still skipped.
+bool CPU::runCompiled(uint64_t cycleDeadline, int& cycles){
+    const DecodedInstruction* page = gb.mmu.decodedPage(regs.PC);
+    JIT* jit = gb.mmu.jit();
+    if(!page || !jit){
+        return false;
     }
-    else if(set && isFlagged(AF.lo, flag)){
-        PC += address;
+    
+    const DecodedInstruction* instruction = page + (regs.PC & 0xFF);
+    const CompiledBlock* block = jit->find(instruction);
+    if(!block){
+        BYTE& heat = blockHeat[jit->offset(instruction) % JIT_HEAT_SIZE];
+        if(++heat < JIT_HOT_VISITS && !jit->isKnownBlock(instruction)){
+            return false;
+        }
+        heat = 0;
+        block = jit->compile(instruction, regs.PC);
     }
-    else if(!set && !isFlagged(AF.lo, flag)){
-        PC += address;
+    
+    if(!block->code){
+        uncompiledPC = regs.PC;
+        return false;
     }
-}
-
-void CPU::CPU_CALL(bool useFlag, const WORD& address, const BYTE& flag, bool set){
-    if(!useFlag || (useFlag && set && isFlagged(AF.lo, flag)) || (useFlag && !set && !isFlagged(AF.lo, flag)) ){
-        CPU_PUSH(PC);
-        PC = address;
+    
+    // The same ROM offset can also be mapped at another address
+    if(block->start != regs.PC){
+        return false;
+    }
+    if(gb.scheduler.now + regs.pendingCycles + block->leadCycles >= cycleDeadline){
+        return false;
+    }
+    if(pollLoopStart > block->start && pollLoopStart < block->end){
+        return false;
     }
+    
+    cycles = 0;
+    if(block->code(*this, regs, &cycles) && regs.PC < block->last && block->last - regs.PC < POLL_LOOP_LENGTH){
+        watchPollLoop(regs.PC, block->last);
+    }
+    return true;
 }
 
-void CPU::CPU_RET(bool useFlag, const BYTE& flag, bool set){
-    if(!useFlag || (useFlag && set && isFlagged(AF.lo, flag)) || (useFlag && !set && !isFlagged(AF.lo, flag))){
-        CPU_POP(PC);
+#endif
+
+#ifdef GB_PAIR_PROFILE
+
+// Counts instruction as following the last one if it runs straight after it from the same
+// ROM bank, the only pairs a superinstruction can be made of, see writeFusions()
+void CPU::countPair(WORD address, const DecodedInstruction& instruction){
+    bool predecoded = gb.mmu.decodedPage(address) && instruction.length;
+    if(predecoded && lastPairLength && address == (WORD) (lastPairAddress + lastPairLength) && !((address ^ lastPairAddress) & 0xC000)){
+        pairs[lastPairHandler * 512 + instruction.handler]++;
     }
+    lastPairAddress = address;
+    lastPairHandler = instruction.handler;
+    lastPairLength = predecoded ? instruction.length : 0;
 }
 
-void CPU::CPU_RETI(){
-    CPU_RET(0, 0, 0);
-    IME = true;
-}
+#endif
 
-void CPU::CPU_RST(const WORD& address){
-    CPU_CALL(false, address, 0, 0);
-}
+// Polling loops
+//
+// Games wait for VBlank or an interrupt by spinning on a register or RAM byte, e.g.
+// LDH A,($44) / CP $90 / JR NZ. A short loop of straight-line code without writes, that
+// ends up with the same registers it started with, will do exactly the same again until
+// something it reads changes. Everything it may read only changes when an event runs or
+// an interrupt is serviced, so the iterations that finish before the deadline are skipped.
 
-void CPU::CPU_RESET(){
-    AF.reg = 0;
-    BC.reg = 0;
-    DE.reg = 0;
-    HL.reg = 0;
-    SP.reg = 0;
-    PC = 0;
-    clock = 0;
-    ifRegister = 0x0;
+// DIV and TIMA count with the clock, and the APU registers follow the channels
+static bool isPollable(WORD address){
+    return !(address >= 0xFF04 && address <= 0xFF05) &&
+           !(address >= 0xFF10 && address <= 0xFF3F);
 }
 
-int CPU::executeExtendedOpcode(const BYTE& opcode){
-    switch(opcode){
-        case 0x00: CPU_RLC(BC.hi); return 8;
-        case 0x01: CPU_RLC(BC.lo); return 8;
-        case 0x02: CPU_RLC(DE.hi); return 8;
-        case 0x03: CPU_RLC(DE.lo); return 8;
-        case 0x04: CPU_RLC(HL.hi); return 8;
-        case 0x05: CPU_RLC(HL.lo); return 8;
-        case 0x07: CPU_RLC(AF.hi); return 8;
-        case 0x06: CPU_RLC_WRITE(); return 16;
-        case 0x10: CPU_RL(BC.hi); return 8;
-        case 0x11: CPU_RL(BC.lo); return 8;
-        case 0x12: CPU_RL(DE.hi); return 8;
-        case 0x13: CPU_RL(DE.lo); return 8;
-        case 0x14: CPU_RL(HL.hi); return 8;
-        case 0x15: CPU_RL(HL.lo); return 8;
-        case 0x17: CPU_RL(AF.hi); return 8;
-        case 0x16: CPU_RL_WRITE(); return 16;
-        case 0x08: CPU_RRC(BC.hi); return 8;
-        case 0x09: CPU_RRC(BC.lo); return 8;
-        case 0x0A: CPU_RRC(DE.hi); return 8;
-        case 0x0B: CPU_RRC(DE.lo); return 8;
-        case 0x0C: CPU_RRC(HL.hi); return 8;
-        case 0x0D: CPU_RRC(HL.lo); return 8;
-        case 0x0F: CPU_RRC(AF.hi); return 8;
-        case 0x0E: CPU_RRC_WRITE(); return 16;
-        case 0x18: CPU_RR(BC.hi); return 8;
-        case 0x19: CPU_RR(BC.lo); return 8;
-        case 0x1A: CPU_RR(DE.hi); return 8;
-        case 0x1B: CPU_RR(DE.lo); return 8;
-        case 0x1C: CPU_RR(HL.hi); return 8;
-        case 0x1D: CPU_RR(HL.lo); return 8;
-        case 0x1F: CPU_RR(AF.hi); return 8;
-        case 0x1E: CPU_RR_WRITE(); return 16;
-        case 0x20: CPU_SLA(BC.hi); return 8;
-        case 0x21: CPU_SLA(BC.lo); return 8;
-        case 0x22: CPU_SLA(DE.hi); return 8;
-        case 0x23: CPU_SLA(DE.lo); return 8;
-        case 0x24: CPU_SLA(HL.hi); return 8;
-        case 0x25: CPU_SLA(HL.lo); return 8;
-        case 0x27: CPU_SLA(AF.hi); return 8;
-        case 0x26: CPU_SLA_WRITE(); return 16;
-        case 0x30: CPU_SWAP(BC.hi); return 8;
-        case 0x31: CPU_SWAP(BC.lo); return 8;
-        case 0x32: CPU_SWAP(DE.hi); return 8;
-        case 0x33: CPU_SWAP(DE.lo); return 8;
-        case 0x34: CPU_SWAP(HL.hi); return 8;
-        case 0x35: CPU_SWAP(HL.lo); return 8;
-        case 0x37: CPU_SWAP(AF.hi); return 8;
-        case 0x36: CPU_SWAP_WRITE(); return 16;
-        case 0x28: CPU_SRA(BC.hi); return 8;
-        case 0x29: CPU_SRA(BC.lo); return 8;
-        case 0x2A: CPU_SRA(DE.hi); return 8;
-        case 0x2B: CPU_SRA(DE.lo); return 8;
-        case 0x2C: CPU_SRA(HL.hi); return 8;
-        case 0x2D: CPU_SRA(HL.lo); return 8;
-        case 0x2F: CPU_SRA(AF.hi); return 8;
-        case 0x2E: CPU_SRA_WRITE(); return 16;
-        case 0x38: CPU_SRL(BC.hi); return 8;
-        case 0x39: CPU_SRL(BC.lo); return 8;
-        case 0x3A: CPU_SRL(DE.hi); return 8;
-        case 0x3B: CPU_SRL(DE.lo); return 8;
-        case 0x3C: CPU_SRL(HL.hi); return 8;
-        case 0x3D: CPU_SRL(HL.lo); return 8;
-        case 0x3F: CPU_SRL(AF.hi); return 8;
-        case 0x3E: CPU_SRL_WRITE(); return 16;
-            // 1-Bit Operations
-        case 0x40: CPU_BIT(0, BC.hi); return 8;
-        case 0x41: CPU_BIT(0, BC.lo); return 8;
-        case 0x42: CPU_BIT(0, DE.hi); return 8;
-        case 0x43: CPU_BIT(0, DE.lo); return 8;
-        case 0x44: CPU_BIT(0, HL.hi); return 8;
-        case 0x45: CPU_BIT(0, HL.lo); return 8;
-        case 0x47: CPU_BIT(0, AF.hi); return 8;
-        case 0x48: CPU_BIT(1, BC.hi); return 8;
-        case 0x49: CPU_BIT(1, BC.lo); return 8;
-        case 0x4A: CPU_BIT(1, DE.hi); return 8;
-        case 0x4B: CPU_BIT(1, DE.lo); return 8;
-        case 0x4C: CPU_BIT(1, HL.hi); return 8;
-        case 0x4D: CPU_BIT(1, HL.lo); return 8;
-        case 0x4F: CPU_BIT(1, AF.hi); return 8;
-        case 0x50: CPU_BIT(2, BC.hi); return 8;
-        case 0x51: CPU_BIT(2, BC.lo); return 8;
-        case 0x52: CPU_BIT(2, DE.hi); return 8;
-        case 0x53: CPU_BIT(2, DE.lo); return 8;
-        case 0x54: CPU_BIT(2, HL.hi); return 8;
-        case 0x55: CPU_BIT(2, HL.lo); return 8;
-        case 0x57: CPU_BIT(2, AF.hi); return 8;
-        case 0x58: CPU_BIT(3, BC.hi); return 8;
-        case 0x59: CPU_BIT(3, BC.lo); return 8;
-        case 0x5A: CPU_BIT(3, DE.hi); return 8;
-        case 0x5B: CPU_BIT(3, DE.lo); return 8;
-        case 0x5C: CPU_BIT(3, HL.hi); return 8;
-        case 0x5D: CPU_BIT(3, HL.lo); return 8;
-        case 0x5F: CPU_BIT(3, AF.hi); return 8;
-        case 0x60: CPU_BIT(4, BC.hi); return 8;
-        case 0x61: CPU_BIT(4, BC.lo); return 8;
-        case 0x62: CPU_BIT(4, DE.hi); return 8;
-        case 0x63: CPU_BIT(4, DE.lo); return 8;
-        case 0x64: CPU_BIT(4, HL.hi); return 8;
-        case 0x65: CPU_BIT(4, HL.lo); return 8;
-        case 0x67: CPU_BIT(4, AF.hi); return 8;
-        case 0x68: CPU_BIT(5, BC.hi); return 8;
-        case 0x69: CPU_BIT(5, BC.lo); return 8;
-        case 0x6A: CPU_BIT(5, DE.hi); return 8;
-        case 0x6B: CPU_BIT(5, DE.lo); return 8;
-        case 0x6C: CPU_BIT(5, HL.hi); return 8;
-        case 0x6D: CPU_BIT(5, HL.lo); return 8;
-        case 0x6F: CPU_BIT(5, AF.hi); return 8;
-        case 0x70: CPU_BIT(6, BC.hi); return 8;
-        case 0x71: CPU_BIT(6, BC.lo); return 8;
-        case 0x72: CPU_BIT(6, DE.hi); return 8;
-        case 0x73: CPU_BIT(6, DE.lo); return 8;
-        case 0x74: CPU_BIT(6, HL.hi); return 8;
-        case 0x75: CPU_BIT(6, HL.lo); return 8;
-        case 0x77: CPU_BIT(6, AF.hi); return 8;
-        case 0x78: CPU_BIT(7, BC.hi); return 8;
-        case 0x79: CPU_BIT(7, BC.lo); return 8;
-        case 0x7A: CPU_BIT(7, DE.hi); return 8;
-        case 0x7B: CPU_BIT(7, DE.lo); return 8;
-        case 0x7C: CPU_BIT(7, HL.hi); return 8;
-        case 0x7D: CPU_BIT(7, HL.lo); return 8;
-        case 0x7F: CPU_BIT(7, AF.hi); return 8;
-        case 0x46: CPU_BIT(0, mmu.readByte(HL.reg)); return 16;
-        case 0x4E: CPU_BIT(1, mmu.readByte(HL.reg)); return 16;
-        case 0x56: CPU_BIT(2, mmu.readByte(HL.reg)); return 16;
-        case 0x5E: CPU_BIT(3, mmu.readByte(HL.reg)); return 16;
-        case 0x66: CPU_BIT(4, mmu.readByte(HL.reg)); return 16;
-        case 0x6E: CPU_BIT(5, mmu.readByte(HL.reg)); return 16;
-        case 0x76: CPU_BIT(6, mmu.readByte(HL.reg)); return 16;
-        case 0x7E: CPU_BIT(7, mmu.readByte(HL.reg)); return 16;
-        case 0xC0: CPU_SET(0, BC.hi); return 8;
-        case 0xC1: CPU_SET(0, BC.lo); return 8;
-        case 0xC2: CPU_SET(0, DE.hi); return 8;
-        case 0xC3: CPU_SET(0, DE.lo); return 8;
-        case 0xC4: CPU_SET(0, HL.hi); return 8;
-        case 0xC5: CPU_SET(0, HL.lo); return 8;
-        case 0xC7: CPU_SET(0, AF.hi); return 8;
-        case 0xC8: CPU_SET(1, BC.hi); return 8;
-        case 0xC9: CPU_SET(1, BC.lo); return 8;
-        case 0xCA: CPU_SET(1, DE.hi); return 8;
-        case 0xCB: CPU_SET(1, DE.lo); return 8;
-        case 0xCC: CPU_SET(1, HL.hi); return 8;
-        case 0xCD: CPU_SET(1, HL.lo); return 8;
-        case 0xCF: CPU_SET(1, AF.hi); return 8;
-        case 0xD0: CPU_SET(2, BC.hi); return 8;
-        case 0xD1: CPU_SET(2, BC.lo); return 8;
-        case 0xD2: CPU_SET(2, DE.hi); return 8;
-        case 0xD3: CPU_SET(2, DE.lo); return 8;
-        case 0xD4: CPU_SET(2, HL.hi); return 8;
-        case 0xD5: CPU_SET(2, HL.lo); return 8;
-        case 0xD7: CPU_SET(2, AF.hi); return 8;
-        case 0xD8: CPU_SET(3, BC.hi); return 8;
-        case 0xD9: CPU_SET(3, BC.lo); return 8;
-        case 0xDA: CPU_SET(3, DE.hi); return 8;
-        case 0xDB: CPU_SET(3, DE.lo); return 8;
-        case 0xDC: CPU_SET(3, HL.hi); return 8;
-        case 0xDD: CPU_SET(3, HL.lo); return 8;
-        case 0xDF: CPU_SET(3, AF.hi); return 8;
-        case 0xE0: CPU_SET(4, BC.hi); return 8;
-        case 0xE1: CPU_SET(4, BC.lo); return 8;
-        case 0xE2: CPU_SET(4, DE.hi); return 8;
-        case 0xE3: CPU_SET(4, DE.lo); return 8;
-        case 0xE4: CPU_SET(4, HL.hi); return 8;
-        case 0xE5: CPU_SET(4, HL.lo); return 8;
-        case 0xE7: CPU_SET(4, AF.hi); return 8;
-        case 0xE8: CPU_SET(5, BC.hi); return 8;
-        case 0xE9: CPU_SET(5, BC.lo); return 8;
-        case 0xEA: CPU_SET(5, DE.hi); return 8;
-        case 0xEB: CPU_SET(5, DE.lo); return 8;
-        case 0xEC: CPU_SET(5, HL.hi); return 8;
-        case 0xED: CPU_SET(5, HL.lo); return 8;
-        case 0xEF: CPU_SET(5, AF.hi); return 8;
-        case 0xF0: CPU_SET(6, BC.hi); return 8;
-        case 0xF1: CPU_SET(6, BC.lo); return 8;
-        case 0xF2: CPU_SET(6, DE.hi); return 8;
-        case 0xF3: CPU_SET(6, DE.lo); return 8;
-        case 0xF4: CPU_SET(6, HL.hi); return 8;
-        case 0xF5: CPU_SET(6, HL.lo); return 8;
-        case 0xF7: CPU_SET(6, AF.hi); return 8;
-        case 0xF8: CPU_SET(7, BC.hi); return 8;
-        case 0xF9: CPU_SET(7, BC.lo); return 8;
-        case 0xFA: CPU_SET(7, DE.hi); return 8;
-        case 0xFB: CPU_SET(7, DE.lo); return 8;
-        case 0xFC: CPU_SET(7, HL.hi); return 8;
-        case 0xFD: CPU_SET(7, HL.lo); return 8;
-        case 0xFF: CPU_SET(7, AF.hi); return 8;
-        case 0xC6: CPU_SET_WRITE(0); return 16;
-        case 0xCE: CPU_SET_WRITE(1); return 16;
-        case 0xD6: CPU_SET_WRITE(2); return 16;
-        case 0xDE: CPU_SET_WRITE(3); return 16;
-        case 0xE6: CPU_SET_WRITE(4); return 16;
-        case 0xEE: CPU_SET_WRITE(5); return 16;
-        case 0xF6: CPU_SET_WRITE(6); return 16;
-        case 0xFE: CPU_SET_WRITE(7); return 16;
-        case 0x80: CPU_RES(0, BC.hi); return 8;
-        case 0x81: CPU_RES(0, BC.lo); return 8;
-        case 0x82: CPU_RES(0, DE.hi); return 8;
-        case 0x83: CPU_RES(0, DE.lo); return 8;
-        case 0x84: CPU_RES(0, HL.hi); return 8;
-        case 0x85: CPU_RES(0, HL.lo); return 8;
-        case 0x87: CPU_RES(0, AF.hi); return 8;
-        case 0x88: CPU_RES(1, BC.hi); return 8;
-        case 0x89: CPU_RES(1, BC.lo); return 8;
-        case 0x8A: CPU_RES(1, DE.hi); return 8;
-        case 0x8B: CPU_RES(1, DE.lo); return 8;
-        case 0x8C: CPU_RES(1, HL.hi); return 8;
-        case 0x8D: CPU_RES(1, HL.lo); return 8;
-        case 0x8F: CPU_RES(1, AF.hi); return 8;
-        case 0x90: CPU_RES(2, BC.hi); return 8;
-        case 0x91: CPU_RES(2, BC.lo); return 8;
-        case 0x92: CPU_RES(2, DE.hi); return 8;
-        case 0x93: CPU_RES(2, DE.lo); return 8;
-        case 0x94: CPU_RES(2, HL.hi); return 8;
-        case 0x95: CPU_RES(2, HL.lo); return 8;
-        case 0x97: CPU_RES(2, AF.hi); return 8;
-        case 0x98: CPU_RES(3, BC.hi); return 8;
-        case 0x99: CPU_RES(3, BC.lo); return 8;
-        case 0x9A: CPU_RES(3, DE.hi); return 8;
-        case 0x9B: CPU_RES(3, DE.lo); return 8;
-        case 0x9C: CPU_RES(3, HL.hi); return 8;
-        case 0x9D: CPU_RES(3, HL.lo); return 8;
-        case 0x9F: CPU_RES(3, AF.hi); return 8;
-        case 0xA0: CPU_RES(4, BC.hi); return 8;
-        case 0xA1: CPU_RES(4, BC.lo); return 8;
-        case 0xA2: CPU_RES(4, DE.hi); return 8;
-        case 0xA3: CPU_RES(4, DE.lo); return 8;
-        case 0xA4: CPU_RES(4, HL.hi); return 8;
-        case 0xA5: CPU_RES(4, HL.lo); return 8;
-        case 0xA7: CPU_RES(4, AF.hi); return 8;
-        case 0xA8: CPU_RES(5, BC.hi); return 8;
-        case 0xA9: CPU_RES(5, BC.lo); return 8;
-        case 0xAA: CPU_RES(5, DE.hi); return 8;
-        case 0xAB: CPU_RES(5, DE.lo); return 8;
-        case 0xAC: CPU_RES(5, HL.hi); return 8;
-        case 0xAD: CPU_RES(5, HL.lo); return 8;
-        case 0xAF: CPU_RES(5, AF.hi); return 8;
-        case 0xB0: CPU_RES(6, BC.hi); return 8;
-        case 0xB1: CPU_RES(6, BC.lo); return 8;
-        case 0xB2: CPU_RES(6, DE.hi); return 8;
-        case 0xB3: CPU_RES(6, DE.lo); return 8;
-        case 0xB4: CPU_RES(6, HL.hi); return 8;
-        case 0xB5: CPU_RES(6, HL.lo); return 8;
-        case 0xB7: CPU_RES(6, AF.hi); return 8;
-        case 0xB8: CPU_RES(7, BC.hi); return 8;
-        case 0xB9: CPU_RES(7, BC.lo); return 8;
-        case 0xBA: CPU_RES(7, DE.hi); return 8;
-        case 0xBB: CPU_RES(7, DE.lo); return 8;
-        case 0xBC: CPU_RES(7, HL.hi); return 8;
-        case 0xBD: CPU_RES(7, HL.lo); return 8;
-        case 0xBF: CPU_RES(7, AF.hi); return 8;
-        case 0x86: CPU_RES_WRITE(0); return 16;
-        case 0x8E: CPU_RES_WRITE(1); return 16;
-        case 0x96: CPU_RES_WRITE(2); return 16;
-        case 0x9E: CPU_RES_WRITE(3); return 16;
-        case 0xA6: CPU_RES_WRITE(4); return 16;
-        case 0xAE: CPU_RES_WRITE(5); return 16;
-        case 0xB6: CPU_RES_WRITE(6); return 16;
-        case 0xBE: CPU_RES_WRITE(7); return 16;
-        default: assert(false); return 0;
-    }
-}
-
-int CPU::executeOpcode(const BYTE& opcode){
+// Address read by a MEMORY_READ instruction at address, given the current registers
+WORD CPU::readAddress(BYTE opcode, const OpcodeInfo& info, WORD address){
+    switch(info.operand){
+        case OPERAND_A8: return 0xFF00 + gb.mmu.readByte(address + 1);
+        case OPERAND_A16: return gb.mmu.readWord(address + 1);
+        default: break;
+    }
     switch(opcode){
-            // 8-Bit Loads
-        case 0x78: CPU_LOAD(AF.hi, BC.hi); return 4;
-        case 0x79: CPU_LOAD(AF.hi, BC.lo); return 4;
-        case 0x7A: CPU_LOAD(AF.hi, DE.hi); return 4;
-        case 0x7B: CPU_LOAD(AF.hi, DE.lo); return 4;
-        case 0x7C: CPU_LOAD(AF.hi, HL.hi); return 4;
-        case 0x7D: CPU_LOAD(AF.hi, HL.lo); return 4;
-        case 0x7F: CPU_LOAD(AF.hi, AF.hi); return 4;
-        case 0x40: CPU_LOAD(BC.hi, BC.hi); return 4;
-        case 0x41: CPU_LOAD(BC.hi, BC.lo); return 4;
-        case 0x42: CPU_LOAD(BC.hi, DE.hi); return 4;
-        case 0x43: CPU_LOAD(BC.hi, DE.lo); return 4;
-        case 0x44: CPU_LOAD(BC.hi, HL.hi); return 4;
-        case 0x45: CPU_LOAD(BC.hi, HL.lo); return 4;
-        case 0x47: CPU_LOAD(BC.hi, AF.hi); return 4;
-        case 0x48: CPU_LOAD(BC.lo, BC.hi); return 4;
-        case 0x49: CPU_LOAD(BC.lo, BC.lo); return 4;
-        case 0x4A: CPU_LOAD(BC.lo, DE.hi); return 4;
-        case 0x4B: CPU_LOAD(BC.lo, DE.lo); return 4;
-        case 0x4C: CPU_LOAD(BC.lo, HL.hi); return 4;
-        case 0x4D: CPU_LOAD(BC.lo, HL.lo); return 4;
-        case 0x4F: CPU_LOAD(BC.lo, AF.hi); return 4;
-        case 0x50: CPU_LOAD(DE.hi, BC.hi); return 4;
-        case 0x51: CPU_LOAD(DE.hi, BC.lo); return 4;
-        case 0x52: CPU_LOAD(DE.hi, DE.hi); return 4;
-        case 0x53: CPU_LOAD(DE.hi, DE.lo); return 4;
-        case 0x54: CPU_LOAD(DE.hi, HL.hi); return 4;
-        case 0x55: CPU_LOAD(DE.hi, HL.lo); return 4;
-        case 0x57: CPU_LOAD(DE.hi, AF.hi); return 4;
-        case 0x58: CPU_LOAD(DE.lo, BC.hi); return 4;
-        case 0x59: CPU_LOAD(DE.lo, BC.lo); return 4;
-        case 0x5A: CPU_LOAD(DE.lo, DE.hi); return 4;
-        case 0x5B: CPU_LOAD(DE.lo, DE.lo); return 4;
-        case 0x5C: CPU_LOAD(DE.lo, HL.hi); return 4;
-        case 0x5D: CPU_LOAD(DE.lo, HL.lo); return 4;
-        case 0x5F: CPU_LOAD(DE.lo, AF.hi); return 4;
-        case 0x60: CPU_LOAD(HL.hi, BC.hi); return 4;
-        case 0x61: CPU_LOAD(HL.hi, BC.lo); return 4;
-        case 0x62: CPU_LOAD(HL.hi, DE.hi); return 4;
-        case 0x63: CPU_LOAD(HL.hi, DE.lo); return 4;
-        case 0x64: CPU_LOAD(HL.hi, HL.hi); return 4;
-        case 0x65: CPU_LOAD(HL.hi, HL.lo); return 4;
-        case 0x67: CPU_LOAD(HL.hi, AF.hi); return 4;
-        case 0x68: CPU_LOAD(HL.lo, BC.hi); return 4;
-        case 0x69: CPU_LOAD(HL.lo, BC.lo); return 4;
-        case 0x6A: CPU_LOAD(HL.lo, DE.hi); return 4;
-        case 0x6B: CPU_LOAD(HL.lo, DE.lo); return 4;
-        case 0x6C: CPU_LOAD(HL.lo, HL.hi); return 4;
-        case 0x6D: CPU_LOAD(HL.lo, HL.lo); return 4;
-        case 0x6F: CPU_LOAD(HL.lo, AF.hi); return 4;
-        case 0x3E: CPU_LOAD(AF.hi, mmu.readByte(PC++)); return 8;
-        case 0x06: CPU_LOAD(BC.hi, mmu.readByte(PC++)); return 8;
-        case 0x0E: CPU_LOAD(BC.lo, mmu.readByte(PC++)); return 8;
-        case 0x16: CPU_LOAD(DE.hi, mmu.readByte(PC++)); return 8;
-        case 0x1E: CPU_LOAD(DE.lo, mmu.readByte(PC++)); return 8;
-        case 0x26: CPU_LOAD(HL.hi, mmu.readByte(PC++)); return 8;
-        case 0x2E: CPU_LOAD(HL.lo, mmu.readByte(PC++)); return 8;
-        case 0x7E: CPU_LOAD(AF.hi, mmu.readByte(HL.reg)); return 8;
-        case 0x46: CPU_LOAD(BC.hi, mmu.readByte(HL.reg)); return 8;
-        case 0x4E: CPU_LOAD(BC.lo, mmu.readByte(HL.reg)); return 8;
-        case 0x56: CPU_LOAD(DE.hi, mmu.readByte(HL.reg)); return 8;
-        case 0x5E: CPU_LOAD(DE.lo, mmu.readByte(HL.reg)); return 8;
-        case 0x66: CPU_LOAD(HL.hi, mmu.readByte(HL.reg)); return 8;
-        case 0x6E: CPU_LOAD(HL.lo, mmu.readByte(HL.reg)); return 8;
-        case 0x70: CPU_LOAD_WRITE(HL.reg, BC.hi); return 8;
-        case 0x71: CPU_LOAD_WRITE(HL.reg, BC.lo); return 8;
-        case 0x72: CPU_LOAD_WRITE(HL.reg, DE.hi); return 8;
-        case 0x73: CPU_LOAD_WRITE(HL.reg, DE.lo); return 8;
-        case 0x74: CPU_LOAD_WRITE(HL.reg, HL.hi); return 8;
-        case 0x75: CPU_LOAD_WRITE(HL.reg, HL.lo); return 8;
-        case 0x77: CPU_LOAD_WRITE(HL.reg, AF.hi); return 8;
-        case 0x36: CPU_LOAD_WRITE(HL.reg, mmu.readByte(PC++)); return 12;
-        case 0x0A: CPU_LOAD(AF.hi, mmu.readByte(BC.reg)); return 8;
-        case 0x1A: CPU_LOAD(AF.hi, mmu.readByte(DE.reg)); return 8;
-        case 0xFA: PC += 2; CPU_LOAD(AF.hi, mmu.readByte(mmu.readWord(PC - 2))); return 16;
-        case 0x02: CPU_LOAD_WRITE(BC.reg, AF.hi); return 8;
-        case 0x12: CPU_LOAD_WRITE(DE.reg, AF.hi); return 8;
-        case 0xEA: PC += 2; CPU_LOAD_WRITE(mmu.readWord(PC - 2), AF.hi); return 16;
-        case 0x08: PC += 2; CPU_LOAD_WRITE_16BIT(mmu.readWord(PC - 2), SP.reg); return 20;
-        case 0xF0: CPU_LOAD(AF.hi, mmu.readByte(0xFF00 + mmu.readByte(PC++))); return 12;
-        case 0xE0: CPU_LOAD_WRITE(0xFF00 + mmu.readByte(PC++), AF.hi); return 12;
-        case 0xF2: CPU_LOAD(AF.hi, mmu.readByte(0xFF00 + BC.lo)); return 8;
-        case 0xE2: CPU_LOAD_WRITE(0xFF00 + BC.lo, AF.hi); return 8;
-        case 0x22: CPU_LOAD_WRITE(HL.reg++, AF.hi); return 8;
-        case 0x2A: CPU_LOAD(AF.hi, mmu.readByte(HL.reg++)); return 8;
-        case 0x32: CPU_LOAD_WRITE(HL.reg--, AF.hi); return 8;
-        case 0x3A: CPU_LOAD(AF.hi, mmu.readByte(HL.reg--)); return 8;
-            // 16-Bit Loads
-        case 0x01: PC += 2; CPU_LOAD_16BIT(BC.reg, mmu.readWord(PC - 2), 0, false); return 12;
-        case 0x11: PC += 2; CPU_LOAD_16BIT(DE.reg, mmu.readWord(PC - 2), 0,false); return 12;
-        case 0x21: PC += 2; CPU_LOAD_16BIT(HL.reg, mmu.readWord(PC - 2), 0, false); return 12;
-        case 0x31: PC += 2; CPU_LOAD_16BIT(SP.reg, mmu.readWord(PC - 2), 0, false); return 12;
-        case 0xF9: CPU_LOAD_16BIT(SP.reg, HL.reg, 0, false); return 8;
-        case 0xC5: CPU_PUSH(BC.reg); return 16;
-        case 0xD5: CPU_PUSH(DE.reg); return 16;
-        case 0xE5: CPU_PUSH(HL.reg); return 16;
-        case 0xF5: AF.reg &= 0xFFF0; CPU_PUSH(AF.reg); return 16;
-        case 0xC1: CPU_POP(BC.reg); return 12;
-        case 0xD1: CPU_POP(DE.reg); return 12;
-        case 0xE1: CPU_POP(HL.reg); return 12;
-        case 0xF1: AF.reg &= 0xFFF0; CPU_POP(AF.reg); return 12;
-            // 8-Bit Arithmetic
-        case 0x80: CPU_ADD(BC.hi, false); return 4;
-        case 0x81: CPU_ADD(BC.lo, false); return 4;
-        case 0x82: CPU_ADD(DE.hi, false); return 4;
-        case 0x83: CPU_ADD(DE.lo, false); return 4;
-        case 0x84: CPU_ADD(HL.hi, false); return 4;
-        case 0x85: CPU_ADD(HL.lo, false); return 4;
-        case 0x87: CPU_ADD(AF.hi, false); return 4;
-        case 0xC6: CPU_ADD(mmu.readByte(PC++), false); return 8;
-        case 0x86: CPU_ADD(mmu.readByte(HL.reg), false); return 8;
-        case 0x88: CPU_ADD(BC.hi, true); return 4;
-        case 0x89: CPU_ADD(BC.lo, true); return 4;
-        case 0x8A: CPU_ADD(DE.hi, true); return 4;
-        case 0x8B: CPU_ADD(DE.lo, true); return 4;
-        case 0x8C: CPU_ADD(HL.hi, true); return 4;
-        case 0x8D: CPU_ADD(HL.lo, true); return 4;
-        case 0x8F: CPU_ADD(AF.hi, true); return 4;
-        case 0xCE: CPU_ADD(mmu.readByte(PC++), true); return 8;
-        case 0x8E: CPU_ADD(mmu.readByte(HL.reg), true); return 8;
-        case 0x90: CPU_SUB(BC.hi, false); return 4;
-        case 0x91: CPU_SUB(BC.lo, false); return 4;
-        case 0x92: CPU_SUB(DE.hi, false); return 4;
-        case 0x93: CPU_SUB(DE.lo, false); return 4;
-        case 0x94: CPU_SUB(HL.hi, false); return 4;
-        case 0x95: CPU_SUB(HL.lo, false); return 4;
-        case 0x97: CPU_SUB(AF.hi, false); return 4;
-        case 0xD6: CPU_SUB(mmu.readByte(PC++), false); return 8;
-        case 0x96: CPU_SUB(mmu.readByte(HL.reg), false); return 8;
-        case 0x98: CPU_SUB(BC.hi, true); return 4;
-        case 0x99: CPU_SUB(BC.lo, true); return 4;
-        case 0x9A: CPU_SUB(DE.hi, true); return 4;
-        case 0x9B: CPU_SUB(DE.lo, true); return 4;
-        case 0x9C: CPU_SUB(HL.hi, true); return 4;
-        case 0x9D: CPU_SUB(HL.lo, true); return 4;
-        case 0x9F: CPU_SUB(AF.hi, true); return 4;
-        case 0xDE: CPU_SUB(mmu.readByte(PC++), true); return 8;
-        case 0x9E: CPU_SUB(mmu.readByte(HL.reg), true); return 8;
-        case 0xA0: CPU_AND(BC.hi); return 4;
-        case 0xA1: CPU_AND(BC.lo); return 4;
-        case 0xA2: CPU_AND(DE.hi); return 4;
-        case 0xA3: CPU_AND(DE.lo); return 4;
-        case 0xA4: CPU_AND(HL.hi); return 4;
-        case 0xA5: CPU_AND(HL.lo); return 4;
-        case 0xA7: CPU_AND(AF.hi); return 4;
-        case 0xE6: CPU_AND(mmu.readByte(PC++)); return 8;
-        case 0xA6: CPU_AND(mmu.readByte(HL.reg)); return 8;
-        case 0xA8: CPU_XOR(BC.hi); return 4;
-        case 0xA9: CPU_XOR(BC.lo); return 4;
-        case 0xAA: CPU_XOR(DE.hi); return 4;
-        case 0xAB: CPU_XOR(DE.lo); return 4;
-        case 0xAC: CPU_XOR(HL.hi); return 4;
-        case 0xAD: CPU_XOR(HL.lo); return 4;
-        case 0xAF: CPU_XOR(AF.hi); return 4;
-        case 0xEE: CPU_XOR(mmu.readByte(PC++)); return 8;
-        case 0xAE: CPU_XOR(mmu.readByte(HL.reg)); return 8;
-        case 0xB0: CPU_OR(BC.hi); return 4;
-        case 0xB1: CPU_OR(BC.lo); return 4;
-        case 0xB2: CPU_OR(DE.hi); return 4;
-        case 0xB3: CPU_OR(DE.lo); return 4;
-        case 0xB4: CPU_OR(HL.hi); return 4;
-        case 0xB5: CPU_OR(HL.lo); return 4;
-        case 0xB7: CPU_OR(AF.hi); return 4;
-        case 0xF6: CPU_OR(mmu.readByte(PC++)); return 8;
-        case 0xB6: CPU_OR(mmu.readByte(HL.reg)); return 8;
-        case 0xB8: CPU_CP(BC.hi); return 4;
-        case 0xB9: CPU_CP(BC.lo); return 4;
-        case 0xBA: CPU_CP(DE.hi); return 4;
-        case 0xBB: CPU_CP(DE.lo); return 4;
-        case 0xBC: CPU_CP(HL.hi); return 4;
-        case 0xBD: CPU_CP(HL.lo); return 4;
-        case 0xBF: CPU_CP(AF.hi); return 4;
-        case 0xFE: CPU_CP(mmu.readByte(PC++)); return 8;
-        case 0xBE: CPU_CP(mmu.readByte(HL.reg)); return 8;
-        case 0x04: CPU_INC(BC.hi); return 4;
-        case 0x0C: CPU_INC(BC.lo); return 4;
-        case 0x14: CPU_INC(DE.hi); return 4;
-        case 0x1C: CPU_INC(DE.lo); return 4;
-        case 0x24: CPU_INC(HL.hi); return 4;
-        case 0x2C: CPU_INC(HL.lo); return 4;
-        case 0x3C: CPU_INC(AF.hi); return 4;
-        case 0x34: CPU_INC_WRITE(); return 12;
-        case 0x05: CPU_DEC(BC.hi); return 4;
-        case 0x0D: CPU_DEC(BC.lo); return 4;
-        case 0x15: CPU_DEC(DE.hi); return 4;
-        case 0x1D: CPU_DEC(DE.lo); return 4;
-        case 0x25: CPU_DEC(HL.hi); return 4;
-        case 0x2D: CPU_DEC(HL.lo); return 4;
-        case 0x3D: CPU_DEC(AF.hi); return 4;
-        case 0x35: CPU_DEC_WRITE(); return 12;
-        case 0x27: CPU_DAA(); return 4;
-        case 0x2F: CPU_CPL(); return 4;
-            // 16-Bit Arithmetic/Logical Commands
-        case 0x09: CPU_ADD_16BIT(HL.reg, BC.reg); return 8;
-        case 0x19: CPU_ADD_16BIT(HL.reg, DE.reg); return 8;
-        case 0x29: CPU_ADD_16BIT(HL.reg, HL.reg); return 8;
-        case 0x39: CPU_ADD_16BIT(HL.reg, SP.reg); return 8;
-        case 0x03: CPU_INC_16BIT(BC.reg); return 8;
-        case 0x13: CPU_INC_16BIT(DE.reg); return 8;
-        case 0x23: CPU_INC_16BIT(HL.reg); return 8;
-        case 0x33: CPU_INC_16BIT(SP.reg); return 8;
-        case 0x0B: CPU_DEC_16BIT(BC.reg); return 8;
-        case 0x1B: CPU_DEC_16BIT(DE.reg); return 8;
-        case 0x2B: CPU_DEC_16BIT(HL.reg); return 8;
-        case 0x3B: CPU_DEC_16BIT(SP.reg); return 8;
-        case 0xE8: CPU_ADD_16BIT_SIGNED(SP.reg, (SIGNED_BYTE) mmu.readByte(PC++)); return 16;
-        case 0xF8: CPU_LOAD_16BIT(HL.reg, SP.reg, (SIGNED_BYTE) mmu.readByte(PC++), true); return 12;
-            // Rotate and Shift Commands
-        case 0x07: CPU_RLCA(AF.hi); return 4;
-        case 0x17: CPU_RLA(AF.hi); return 4;
-        case 0x0F: CPU_RRCA(AF.hi); return 4;
-        case 0x1F: CPU_RRA(AF.hi); return 4;
-            // Includes the rotate/shift + 1-bit operations
-        case 0xCB: return executeExtendedOpcode(mmu.readByte(PC++));
-            // CPU-Control Commands
-        case 0x3F: CPU_CCF(); return 4;
-        case 0x37: CPU_SCF(); return 4;
-        case 0x00: return 4;
-        case 0x76: CPU_HALT(); if(!halt){return 4 + executeOpcode(mmu.readByte(PC));} return 4;
-        case 0x10: return 4;
-        case 0xF3: CPU_DI(); return 4;
-        case 0xFB: CPU_EI(); return 4;
-            // Jump Commands
-        case 0xC3: PC += 2; CPU_JP(0, mmu.readWord(PC - 2), 0, 0); return 16;
-        case 0xE9: CPU_JP(0, HL.reg, 0, 0); return 4;
-        case 0xC2: PC += 2; CPU_JP(1, mmu.readWord(PC - 2), FLAG_Z, 0); return !isFlagged(AF.lo, FLAG_Z) ? 16 : 12;
-        case 0xCA: PC += 2; CPU_JP(1, mmu.readWord(PC - 2), FLAG_Z, 1); return isFlagged(AF.lo, FLAG_Z) ? 16 : 12;
-        case 0xD2: PC += 2; CPU_JP(1, mmu.readWord(PC - 2), FLAG_C, 0); return !isFlagged(AF.lo, FLAG_C) ? 16 : 12;
-        case 0xDA: PC += 2; CPU_JP(1, mmu.readWord(PC - 2), FLAG_C, 1); return isFlagged(AF.lo, FLAG_C) ? 16 : 12;
-        case 0x18: CPU_JR(0, (SIGNED_BYTE) mmu.readByte(PC++), 0, 0); return 12;
-        case 0x20: CPU_JR(1, (SIGNED_BYTE) mmu.readByte(PC++), FLAG_Z, 0); return !isFlagged(AF.lo, FLAG_Z) ? 12 : 8;
-        case 0x28: CPU_JR(1, (SIGNED_BYTE) mmu.readByte(PC++), FLAG_Z, 1); return isFlagged(AF.lo, FLAG_Z) ? 12 : 8;
-        case 0x30: CPU_JR(1, (SIGNED_BYTE) mmu.readByte(PC++), FLAG_C, 0); return !isFlagged(AF.lo, FLAG_C) ? 12 : 8;
-        case 0x38: CPU_JR(1, (SIGNED_BYTE) mmu.readByte(PC++), FLAG_C, 1); return isFlagged(AF.lo, FLAG_C) ? 12 : 8;
-        case 0xCD: PC += 2; CPU_CALL(0, mmu.readWord(PC - 2), 0, 0); return 24;
-        case 0xC4: PC += 2; CPU_CALL(1, mmu.readWord(PC - 2), FLAG_Z, 0); return !isFlagged(AF.lo, FLAG_Z) ? 24 : 12;
-        case 0xCC: PC += 2; CPU_CALL(1, mmu.readWord(PC - 2), FLAG_Z, 1); return isFlagged(AF.lo, FLAG_Z) ? 24 : 12;
-        case 0xD4: PC += 2; CPU_CALL(1, mmu.readWord(PC - 2), FLAG_C, 0); return !isFlagged(AF.lo, FLAG_C) ? 24 : 12;
-        case 0xDC: PC += 2; CPU_CALL(1, mmu.readWord(PC - 2), FLAG_C, 1); return isFlagged(AF.lo, FLAG_C) ? 24 : 12;
-        case 0xC9: CPU_RET(0, 0, 0); return 16;
-        case 0xC0: CPU_RET(1, FLAG_Z, 0); return !isFlagged(AF.lo, FLAG_Z) ? 20 : 8;
-        case 0xC8: CPU_RET(1, FLAG_Z, 1); return isFlagged(AF.lo, FLAG_Z) ? 20 : 8;
-        case 0xD0: CPU_RET(1, FLAG_C, 0); return !isFlagged(AF.lo, FLAG_C) ? 20 : 8;
-        case 0xD8: CPU_RET(1, FLAG_C, 1); return isFlagged(AF.lo, FLAG_C) ? 20 : 8;
-        case 0xD9: CPU_RETI(); return 16;
-        case 0xC7: CPU_RST(0x0000); return 16;
-        case 0xCF: CPU_RST(0x0008); return 16;
-        case 0xD7: CPU_RST(0x0010); return 16;
-        case 0xDF: CPU_RST(0x0018); return 16;
-        case 0xE7: CPU_RST(0x0020); return 16;
-        case 0xEF: CPU_RST(0x0028); return 16;
-        case 0xF7: CPU_RST(0x0030); return 16;
-        case 0xFF: CPU_RST(0x0038); return 16;
-        default: assert(false); return 0;
+        case 0x0A: return regs.BC.reg;
+        case 0x1A: return regs.DE.reg;
+        case 0xF2: return 0xFF00 + regs.BC.lo;
+        default: return regs.HL.reg;
     }
 }
 
-void CPU::reset(){
-    CPU_RESET();
-}
-
-void CPU::addToClock(int clockCycles){
-    clock += clockCycles;
+// Called on a jump from branch back to start
+void CPU::watchPollLoop(WORD start, WORD branch){
+    if((start == pollLoopStart && branch == pollLoopBranch) ||
+       (start == rejectedLoopStart && branch == rejectedLoopBranch)){
+        return;
+    }
+    pollLoopStart = start;
+    pollLoopBranch = branch;
+    pollLoopCycles = 0;
 }
 
-void CPU::handleInterrupts(){
-    
-    // Check what interrupts are enabled by using the IE and IF registers respectively
-    BYTE interrupts =  ifRegister & ieRegister & 0x1F;
-    
-    if(halt && interrupts){
-        PC++;
-        halt = false;
+// Checks the loop can be skipped and times one iteration
+bool CPU::decodePollLoop(){
+    if(pollLoopStart >= 0xFF00 && pollLoopStart < 0xFF80){
+        return false;
     }
     
-    if(!IME){
-        return;
+    int loopCycles = 0;
+    WORD address = pollLoopStart;
+    while(address < pollLoopBranch){
+        BYTE opcode = gb.mmu.readByte(address);
+        const OpcodeInfo& info = opcode == 0xCB ? extendedOpcodeInfo[gb.mmu.readByte(address + 1)] : opcodeInfo[opcode];
+        
+        if(info.endsBlock || (info.memory != MEMORY_NONE && info.memory != MEMORY_READ)){
+            return false;
+        }
+        if(info.memory == MEMORY_READ && !isPollable(readAddress(opcode, info, address))){
+            return false;
+        }
+        loopCycles += info.cycles;
+        address += info.length;
+    }
+    if(address != pollLoopBranch){
+        return false;
     }
     
-    // V-blank interrupt
-    if(interrupts & 0x1){
-        IME = false;
-        ifRegister &= 0xFE;
-        CPU_RST(0x0040);
+    // JR or JP, conditional or not, back to the start
+    BYTE opcode = gb.mmu.readByte(address);
+    WORD target = 0;
+    if(opcode == 0x18 || (opcode & 0xE7) == 0x20){
+        target = address + 2 + (SIGNED_BYTE) gb.mmu.readByte(address + 1);
+    }
+    else if(opcode == 0xC3 || (opcode & 0xE7) == 0xC2){
+        target = gb.mmu.readWord(address + 1);
     }
-    // LCD STAT
-    else if(interrupts & 0x2){
-        IME = false;
-        ifRegister &= 0xFD;
-        CPU_RST(0x0048);
+    if(target != pollLoopStart){
+        return false;
     }
-    // Timer
-    else if(interrupts & 0x4){
-        IME = false;
-        ifRegister &= 0xFB;
-        CPU_RST(0x0050);
+    
+    pollLoopCycles = loopCycles + opcodeInfo[opcode].takenCycles;
+    return true;
+}
+
+// Called with PC at the start of the loop, returns the cycles skipped
+int CPU::skipPollLoop(uint64_t cycleDeadline){
+    uint64_t time = gb.scheduler.now + regs.pendingCycles;
+    materialiseFlags();
+    WORD registers[5] = {regs.AF.reg, regs.BC.reg, regs.DE.reg, regs.HL.reg, regs.SP.reg};
+    
+    // Exactly one iteration since the last time here, so no interrupt was serviced, and
+    // the same deadline, so no event ran
+    bool repeated = pollLoopCycles && time - pollLoopTime == (uint64_t) pollLoopCycles &&
+                    cycleDeadline == pollLoopDeadline &&
+                    memcmp(registers, pollLoopRegisters, sizeof(registers)) == 0;
+    
+    memcpy(pollLoopRegisters, registers, sizeof(registers));
+    pollLoopTime = time;
+    pollLoopDeadline = cycleDeadline;
+    
+    if(!repeated){
+        if(!decodePollLoop()){
+            rejectedLoopStart = pollLoopStart;
+            rejectedLoopBranch = pollLoopBranch;
+            pollLoopStart = 0xFFFF;
+        }
+        return 0;
     }
-    // Joypad
-    else if(interrupts & 0x10){
-        IME = false;
-        ifRegister &= 0xEF;
-        CPU_RST(0x0060);
+    
+    // An interrupt would be serviced at the end of the batch
+    if(regs.IME && regs.pendingInterrupts){
+        return 0;
     }
+    
+    int clockCycles = (int) ((cycleDeadline - time) / pollLoopCycles) * pollLoopCycles;
+    pollLoopTime += clockCycles;
+    return clockCycles;
 }
 
-int CPU::step(){
-    return executeOpcode(mmu.readByte(PC++));
+void CPU::syncDevices(){
+    int clockCycles = regs.pendingCycles;
+    if(clockCycles == 0){
+        return;
+    }
+    regs.pendingCycles = 0;
+    gb.scheduler.advance(clockCycles);
 }
 
-CPU cpu;
+void CPU::ioAccess(){
+    syncDevices();
+    regs.exitRequested = true;
+}
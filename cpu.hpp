@@ -1,19 +1,58 @@
 #ifndef cpu_hpp
 #define cpu_hpp
 
-// register.h
-#define FLAG_Z 0x80
-#define FLAG_N 0x40
-#define FLAG_HC 0x20
-#define FLAG_C 0x10
-
+#include <cstdint>
+#include <memory>
 #include "definitions.hpp"
+#include "alu.hpp"
+#include "registers.hpp"
+#ifdef GB_JIT_ENABLED
+#include "native.hpp"
+#endif
+
+// glibc's <sched.h>, which <memory> pulls in through <pthread.h>, has CPU set macros by the
+// same names as some of the helpers below
+#undef CPU_AND
+#undef CPU_OR
+#undef CPU_XOR
+#undef CPU_SET
+
+// Longest polling loop, in bytes, that CPU::skipPollLoop() looks at
+#define POLL_LOOP_LENGTH 16
+
+// Counters for block starts not compiled yet, by ROM offset, see CPU::runCompiled()
+#define JIT_HEAT_SIZE 4096
+
+struct OpcodeInfo;
+struct DecodedInstruction;
+
+class GameBoy;
+class JIT;
 
 class CPU{
     
-    int clock = 0;
-    bool halt = false;
-    bool IME = false;
+    GameBoy& gb;
+    
+    // Polling loop being watched, see CPU::skipPollLoop(). 0xFFFF is no loop.
+    WORD pollLoopStart = 0xFFFF;
+    WORD pollLoopBranch = 0;
+    WORD rejectedLoopStart = 0xFFFF;
+    WORD rejectedLoopBranch = 0;
+    int pollLoopCycles = 0;
+    uint64_t pollLoopTime = 0;
+    uint64_t pollLoopDeadline = 0;
+    WORD pollLoopRegisters[5] = {};
+    
+    WORD readAddress(BYTE opcode, const OpcodeInfo& info, WORD address);
+    void watchPollLoop(WORD start, WORD branch);
+    bool decodePollLoop();
+    int skipPollLoop(uint64_t cycleDeadline);
+    
+    // Lazy flags, see CPU::materialiseFlags()
+    void setFlags(BYTE op, BYTE left, BYTE right, BYTE result, bool carry);
+    void writeFlags(BYTE f);
+    BYTE& flags();
+    bool carryFlag();
     
     // 8-bit loads
     void CPU_LOAD(BYTE& b1, const BYTE& b2);
@@ -44,33 +83,14 @@ class CPU{
     void CPU_ADD_16BIT_SIGNED(WORD& reg, const SIGNED_BYTE& val);
     void CPU_INC_16BIT(WORD& reg);
     void CPU_DEC_16BIT(WORD& reg);
-    void CPU_RLC(BYTE& reg);
-    void CPU_RLCA(BYTE& reg);
-    void CPU_RL(BYTE& reg);
-    void CPU_RLA(BYTE& reg);
-    void CPU_RRC(BYTE& reg);
-    void CPU_RR(BYTE& reg);
-    void CPU_RRCA(BYTE& reg);
-    void CPU_RRA(BYTE& reg);
-    void CPU_RLC_WRITE();
-    void CPU_RL_WRITE();
-    void CPU_RRC_WRITE();
-    void CPU_RR_WRITE();
-    void CPU_SLA(BYTE& reg);
-    void CPU_SLA_WRITE();
-    void CPU_SWAP(BYTE& reg);
-    void CPU_SWAP_WRITE();
-    void CPU_SRA(BYTE& reg);
-    void CPU_SRA_WRITE();
-    void CPU_SRL(BYTE& reg);
-    void CPU_SRL_WRITE();
+    
+    // Rotate and Shift Commands
+    template<int OP> BYTE CPU_SHIFT(BYTE val);
     
     // 1-bit Operations
-    void CPU_BIT(const BYTE& bit, const BYTE& reg);
-    void CPU_SET(const BYTE& bit, BYTE& reg);
-    void CPU_SET_WRITE(const BYTE& bit);
-    void CPU_RES(const BYTE& bit, BYTE& reg);
-    void CPU_RES_WRITE(const BYTE& bit);
+    template<int BIT> void CPU_BIT(BYTE val);
+    template<int BIT> BYTE CPU_SET(BYTE val);
+    template<int BIT> BYTE CPU_RES(BYTE val);
     
     // CPU Control
     void CPU_CCF();
@@ -90,17 +110,101 @@ class CPU{
     void CPU_RST(const WORD& address);
     void CPU_RESET();
     
-    int executeExtendedOpcode(const BYTE& opcode);
-    int executeOpcode(const BYTE& opcode);
+    // Operands in opcode encoding order, see CPU::handleOpcode<OPCODE>()
+    template<int R> BYTE& reg8();
+    template<int P> WORD& reg16();
+    template<int P> WORD& stackReg16();
+    template<int R> BYTE readOperand();
+    template<int R> void writeOperand(BYTE val);
+    
+    // One handler per opcode then one per 0xCB opcode, see CPU::handleOpcode<OPCODE>() in
+    // cpu.cpp, then one per pair in fusions.hpp, see CPU::handleFused(). The immediate
+    // operand has already been fetched and PC moved past it.
+    typedef int (CPU::*OpcodeHandler)(WORD operand);
+    static const OpcodeHandler handlerTable[];
+    
+    template<BYTE OPCODE> int handleExtendedOpcode(WORD operand);
+    template<BYTE OPCODE> int handleOpcode(WORD operand);
+    template<WORD HANDLER> int handle(WORD operand);
+    template<WORD FIRST, WORD SECOND> int handleFused(WORD operand);
+    
+    // Deadline of the batch running, and where the second half of the last superinstruction
+    // ran from if it did, see CPU::handleFused(). 0xFFFF is none.
+    uint64_t batchDeadline = 0;
+    WORD fusedSecondPC = 0xFFFF;
+    
+    DecodedInstruction decode(WORD opcodeAddress, WORD operandAddress);
+    DecodedInstruction fetch();
+    int execute(const DecodedInstruction& instruction);
+    int executeNext();
+    
+#ifdef GB_JIT_ENABLED
+    friend class JIT;
+    
+    // Handlers as plain functions for compiled code to call, in handlerTable order
+    static const CompiledHandler compiledHandlerTable[512];
+    
+    template<BYTE OPCODE> static int compiledOpcode(CPU& cpu, WORD operand);
+    template<BYTE OPCODE> static int compiledExtendedOpcode(CPU& cpu, WORD operand);
+    
+    // Jumps to each block start not compiled yet, see CPU::runCompiled()
+    BYTE blockHeat[JIT_HEAT_SIZE] = {};
+    
+    // Last block start found not worth compiling, so a loop spinning on it skips the lookup.
+    // Forgotten every runUntil(), as a bank switch can put another block there.
+    WORD uncompiledPC = 0xFFFF;
+    
+    bool runCompiled(uint64_t cycleDeadline, int& cycles);
+#endif
+    
+#ifdef GB_PAIR_PROFILE
+    // Times each handler ran straight after another, see CPU::countPair()
+    std::unique_ptr<uint64_t[]> pairs{new uint64_t[512 * 512]()};
+    WORD lastPairAddress = 0;
+    WORD lastPairHandler = 0;
+    BYTE lastPairLength = 0;    // 0 if it wasn't predecoded
+    
+    void countPair(WORD address, const DecodedInstruction& instruction);
+#endif
     
 public:
     
+    explicit CPU(GameBoy& gb) : gb(gb){}
+    
+    Registers regs = {};
+    
+#ifdef GB_JIT_ENABLED
+    // Cleared to interpret everything, e.g. to check compiled blocks against
+    bool runsCompiled = true;
+#endif
+    
+#ifdef GB_PAIR_PROFILE
+    // Indexed by the first handler * 512 + the second, as in DecodedInstruction
+    const uint64_t* pairCounts() const { return pairs.get(); }
+#endif
+    
+    // Writes any pending flags into AF.lo
+    void materialiseFlags();
+    
     void reset();
-    void addToClock(int clockCycles);
     void handleInterrupts();
+    
+    // Sets an interrupt bit in IF
+    void requestInterrupt(BYTE interrupt);
+    
+    // Called after IF or IE are written directly
+    void updateInterrupts();
     int step();
+    
+    // Runs instructions until the master clock reaches cycleDeadline or the
+    // interrupt state may have changed, returns the cycles actually run
+    int runUntil(uint64_t cycleDeadline);
+    
+    // Moves the master clock up to the instructions run so far
+    void syncDevices();
+    
+    // Called by the MMU before an I/O register is read or written
+    void ioAccess();
 };
 
-extern CPU cpu;
-
 #endif /* cpu_hpp */
@@ -3,18 +3,22 @@
 
 #include "definitions.hpp"
 
+class GameBoy;
+
 class Debug{
     
+    GameBoy& gb;
+    
 public:
     
-    void disassembleExtendedOpcode(const BYTE& opcode);
-    void disassembleOpcode(const BYTE& opcode);
+    explicit Debug(GameBoy& gb) : gb(gb){}
+    
     void printState();
+    
+    // The instruction at PC, then the registers. A whole ROM is disassembled by writeDisassembly().
     void printLog();
     void printTileSet();
     void printTileMap();
 };
 
-extern Debug debug;
-
 #endif /* debug_hpp */
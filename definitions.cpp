@@ -7,3 +7,18 @@
 //
 
 #include "definitions.hpp"
+
+// Anything kept outside the process is laid out by these, so a change to any of them
+// rebuilds this file and so changes the ID
+#include "isa.hpp"
+#include "native.hpp"
+#include "registers.hpp"
+
+// When this file was built, unless it's defined to pin it down
+#ifndef GB_BUILD_ID
+#define GB_BUILD_ID __DATE__ " " __TIME__
+#endif
+
+const char* buildID(){
+    return GB_BUILD_ID;
+}
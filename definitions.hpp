@@ -11,9 +11,21 @@
 
 #define CLOCKSPEED 4194304
 
+// GB_JIT runs hot ROM code as compiled blocks, see JIT. Blocks are only compiled as they're
+// found on x86-64 hosts, any host can run blocks recompiled ahead of time, see Recompiler.
+#if defined(GB_JIT) && (defined(__GNUC__) || defined(__clang__))
+#define GB_JIT_ENABLED 1
+#if defined(__x86_64__)
+#define GB_JIT_X86_64 1
+#endif
+#endif
+
 typedef unsigned char BYTE;
 typedef char SIGNED_BYTE;
 typedef unsigned short WORD;
 typedef short SIGNED_WORD;
 
+// Differs between builds from different sources, see GB_BUILD_ID in definitions.cpp
+const char* buildID();
+
 #endif /* definitions_hpp */
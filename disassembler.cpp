@@ -0,0 +1,146 @@
+#include "disassembler.hpp"
+#include "controlFlow.hpp"
+#include "romImage.hpp"
+#include <SDL2/SDL.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// Bytes listed on one line of data
+#define DATA_LINE_LENGTH 4
+
+// Runs of one byte at least this long that nothing reached, padding mostly, take one line
+#define FILL_LENGTH 16
+
+std::string disassemble(const DecodedInstruction& instruction, WORD address){
+    const OpcodeInfo& info = instructionInfo(instruction);
+    const char* token = info.operand == OPERAND_NONE ? nullptr : strstr(info.mnemonic, operandTokens[info.operand]);
+    if(token == nullptr){
+        return info.mnemonic;
+    }
+    
+    // JR targets are relative to the next instruction
+    char value[8];
+    switch(info.operand){
+        case OPERAND_N16:
+        case OPERAND_A16: snprintf(value, sizeof(value), "$%04X", instruction.operand); break;
+        case OPERAND_A8: snprintf(value, sizeof(value), "$%04X", 0xFF00 + (instruction.operand & 0xFF)); break;
+        case OPERAND_E8:
+            if(info.endsBlock){
+                snprintf(value, sizeof(value), "$%04X", (WORD) (address + instruction.length + (SIGNED_BYTE) instruction.operand));
+                break;
+            }
+            snprintf(value, sizeof(value), "$%02X", instruction.operand & 0xFF);
+            break;
+        default: snprintf(value, sizeof(value), "$%02X", instruction.operand & 0xFF); break;
+    }
+    
+    std::string text(info.mnemonic, token - info.mnemonic);
+    text += value;
+    text += token + strlen(operandTokens[info.operand]);
+    return text;
+}
+
+// Labels name what reached the block, most telling first
+static const char* labelKind(BYTE marks){
+    if(marks & FLOW_ENTRY){
+        return "entry";
+    }
+    if(marks & FLOW_CALL_TARGET){
+        return "call";
+    }
+    if(marks & FLOW_JUMP_TARGET){
+        return "jump";
+    }
+    return nullptr;
+}
+
+// Lists bytes from at up to the next instruction, a line at a time, and returns where it stopped
+static int writeData(FILE* out, const ControlFlow& flow, const BYTE* bytes, size_t bankStart, int number, WORD base, int at){
+    BYTE kind = flow.marks(bankStart + at) & FLOW_TABLE;
+    if(kind && (at == 0 || !(flow.marks(bankStart + at - 1) & FLOW_TABLE))){
+        fprintf(out, "\ntable_%02X_%04X:\n", number, base + at);
+    }
+    
+    // Whether a byte's on this line rather than the next
+    auto sameLine = [&](int offset){
+        if(offset >= ROM_BANK_SIZE){
+            return false;
+        }
+        BYTE marks = flow.marks(bankStart + offset);
+        return !(marks & FLOW_CODE) && (marks & FLOW_TABLE) == kind;
+    };
+    
+    int fill = at;
+    while(!kind && sameLine(fill) && bytes[fill] == bytes[at]){
+        fill++;
+    }
+    if(fill - at >= FILL_LENGTH){
+        fprintf(out, "    %02X:%04X  %-12s DS %d,$%02X\n", number, base + at, "", fill - at, bytes[at]);
+        return fill;
+    }
+    
+    char hex[3 * DATA_LINE_LENGTH + 1] = {};
+    std::string values;
+    int end = at;
+    while(end - at < DATA_LINE_LENGTH && sameLine(end)){
+        char value[8];
+        snprintf(hex + 3 * (end - at), 4, "%02X ", bytes[end]);
+        snprintf(value, sizeof(value), end > at ? ",$%02X" : "$%02X", bytes[end]);
+        values += value;
+        end++;
+    }
+    fprintf(out, "    %02X:%04X  %-12s DB %s\n", number, base + at, hex, values.c_str());
+    return end;
+}
+
+bool writeDisassembly(const ROMImage& rom, const std::string& path){
+    FILE* out = fopen(path.c_str(), "w");
+    if(!out){
+        SDL_Log("Could not write %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    
+    const ControlFlow& flow = rom.controlFlow();
+    fprintf(out, "; %d banks, cartridge type $%02X. Code ControlFlow didn't reach is listed as data.\n",
+            rom.bankCount(), rom.type());
+    
+    for(int number = 0; number < rom.bankCount(); number++){
+        const BYTE* bytes = rom.bank(number);
+        const DecodedInstruction* decoded = rom.decodedBank(number);
+        size_t bankStart = (size_t) number * ROM_BANK_SIZE;
+        WORD base = number ? 0x4000 : 0x0000;
+        fprintf(out, "\n; Bank $%02X\n", number);
+        
+        int at = 0;
+        while(at < ROM_BANK_SIZE){
+            BYTE marks = flow.marks(bankStart + at);
+            if(!(marks & FLOW_CODE)){
+                at = writeData(out, flow, bytes, bankStart, number, base, at);
+                continue;
+            }
+            
+            if(marks & FLOW_BLOCK){
+                const char* kind = labelKind(marks);
+                fprintf(out, "\n");
+                if(kind){
+                    fprintf(out, "%s_%02X_%04X:\n", kind, number, base + at);
+                }
+            }
+            
+            const DecodedInstruction& instruction = decoded[at];
+            char hex[3 * 3 + 1] = {};
+            for(int i = 0; i < instruction.length; i++){
+                snprintf(hex + 3 * i, 4, "%02X ", bytes[at + i]);
+            }
+            fprintf(out, "    %02X:%04X  %-12s %s\n", number, base + at, hex, disassemble(instruction, base + at).c_str());
+            at += instruction.length;
+        }
+    }
+    
+    if(fclose(out) != 0){
+        SDL_Log("Could not write %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,19 @@
+#ifndef disassembler_hpp
+#define disassembler_hpp
+
+#include <string>
+#include "definitions.hpp"
+#include "isa.hpp"
+
+class ROMImage;
+
+// An instruction as it's written, with its operand filled in. JR targets are worked out
+// from address, where the instruction is.
+std::string disassemble(const DecodedInstruction& instruction, WORD address);
+
+// The whole ROM as assembly, laid out by ControlFlow. Code is listed an instruction a line
+// under a label for each jump, call and entry target, and everything else a few bytes a
+// line. Logs why through SDL_Log and returns false if the file can't be written.
+bool writeDisassembly(const ROMImage& rom, const std::string& path);
+
+#endif /* disassembler_hpp */
@@ -0,0 +1,116 @@
+#include "fusionProfile.hpp"
+#include "isa.hpp"
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// DecodedInstruction::fusion has room for no more
+#define MAX_FUSIONS 255
+
+// Pairs kept in path, by first handler * 512 + second. Nothing if there's no file yet.
+static bool readPairCounts(const std::string& path, std::vector<uint64_t>& counts, bool required){
+    counts.assign(512 * 512, 0);
+    FILE* in = fopen(path.c_str(), "r");
+    if(!in){
+        if(errno == ENOENT && !required){
+            return true;
+        }
+        SDL_Log("Could not read %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    
+    unsigned first, second;
+    unsigned long long count;
+    while(fscanf(in, "%x %x %llu", &first, &second, &count) == 3){
+        if(first < 512 && second < 512){
+            counts[first * 512 + second] += count;
+        }
+    }
+    bool damaged = !feof(in);
+    fclose(in);
+    if(damaged){
+        SDL_Log("%s isn't a file of pair counts", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool savePairCounts(const uint64_t* counts, const std::string& path){
+    std::vector<uint64_t> total;
+    if(!readPairCounts(path, total, false)){
+        return false;
+    }
+    for(size_t i = 0; i < total.size(); i++){
+        total[i] += counts[i];
+    }
+    
+    FILE* out = fopen(path.c_str(), "w");
+    if(!out){
+        SDL_Log("Could not write %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    for(size_t i = 0; i < total.size(); i++){
+        if(total[i]){
+            fprintf(out, "%03X %03X %llu\n", (unsigned) (i / 512), (unsigned) (i % 512), (unsigned long long) total[i]);
+        }
+    }
+    if(fclose(out) != 0){
+        SDL_Log("Could not write %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Table entry for a handler, either table
+static const OpcodeInfo& handlerInfo(WORD handler){
+    return instructionInfo({handler, 0, 0, 0});
+}
+
+bool writeFusions(const std::string& countsPath, int count, const std::string& outputPath){
+    std::vector<uint64_t> counts;
+    if(!readPairCounts(countsPath, counts, true)){
+        return false;
+    }
+    
+    // The first half can't change where the second is, illegal opcodes never run and 0xCB
+    // is always decoded along with the byte after it
+    std::vector<int> candidates;
+    for(int i = 0; i < (int) counts.size(); i++){
+        const OpcodeInfo& first = handlerInfo(i / 512);
+        const OpcodeInfo& second = handlerInfo(i % 512);
+        if(counts[i] && first.cycles && !first.endsBlock && second.cycles && i / 512 != 0xCB){
+            candidates.push_back(i);
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [&](int a, int b){
+        return counts[a] > counts[b];
+    });
+    candidates.resize(std::min((size_t) std::min(count, MAX_FUSIONS), candidates.size()));
+    std::sort(candidates.begin(), candidates.end());
+    
+    FILE* out = fopen(outputPath.c_str(), "w");
+    if(!out){
+        SDL_Log("Could not write %s: %s", outputPath.c_str(), strerror(errno));
+        return false;
+    }
+    fprintf(out, "#ifndef fusions_hpp\n#define fusions_hpp\n\n"
+                 "// Instruction pairs the interpreter runs as one superinstruction, see CPU::handleFused().\n"
+                 "// Written by --fusions from opcode pair counts, see writeFusions(), and kept in handler\n"
+                 "// order. Handlers as in DecodedInstruction, 0x100 + the second byte for 0xCB.\n"
+                 "#define FOR_EACH_FUSION(X)");
+    for(int i : candidates){
+        fprintf(out, " \\\n    X(0x%03X, 0x%03X) /* %s, %s */", i / 512, i % 512, handlerInfo(i / 512).mnemonic,
+                handlerInfo(i % 512).mnemonic);
+    }
+    fprintf(out, "\n\n#endif /* fusions_hpp */\n");
+    if(fclose(out) != 0){
+        SDL_Log("Could not write %s: %s", outputPath.c_str(), strerror(errno));
+        return false;
+    }
+    
+    SDL_Log("Wrote %zu fusions to %s", candidates.size(), outputPath.c_str());
+    return true;
+}
@@ -0,0 +1,19 @@
+#ifndef fusionProfile_hpp
+#define fusionProfile_hpp
+
+#include <cstdint>
+#include <string>
+#include "definitions.hpp"
+
+// Adds pair counts from a GB_PAIR_PROFILE build, see CPU::pairCounts(), to the ones kept in
+// path, a line per pair, so the file builds up over a corpus of ROMs. Starts the file if
+// there isn't one. Logs why through SDL_Log and returns false if it can't be read or written.
+bool savePairCounts(const uint64_t* counts, const std::string& path);
+
+// Writes fusions.hpp to outputPath with the count pairs run most in the counts kept in
+// countsPath that can be fused: a first half that carries on to the next instruction and a
+// second half that's a legal instruction. Logs why through SDL_Log and returns false if
+// either file can't be read or written.
+bool writeFusions(const std::string& countsPath, int count, const std::string& outputPath);
+
+#endif /* fusionProfile_hpp */
@@ -0,0 +1,37 @@
+#ifndef fusions_hpp
+#define fusions_hpp
+
+// Instruction pairs the interpreter runs as one superinstruction, see CPU::handleFused().
+// Picked by hand, BIT n,r only for A to keep the inlined handlers down. --fusions can write
+// this file from the pair counts of a GB_PAIR_PROFILE build, see writeFusions(), but hasn't
+// been run over a corpus for it yet. The halves don't share a flag update, each still sets
+// its own. Kept in handler order. Handlers as in DecodedInstruction, 0x100 + the second
+// byte for 0xCB.
+#define FOR_EACH_FUSION(X) \
+    X(0x005, 0x020) /* DEC B, JR NZ,e8 */ \
+    X(0x02A, 0x012) /* LD A,(HL+), LD (DE),A */ \
+    X(0x0C1, 0x0F1) /* POP BC, POP AF */ \
+    X(0x0C5, 0x0D5) /* PUSH BC, PUSH DE */ \
+    X(0x0D1, 0x0C1) /* POP DE, POP BC */ \
+    X(0x0D5, 0x0E5) /* PUSH DE, PUSH HL */ \
+    X(0x0E1, 0x0D1) /* POP HL, POP DE */ \
+    X(0x0F0, 0x0FE) /* LDH A,(a8), CP n8 */ \
+    X(0x0F5, 0x0C5) /* PUSH AF, PUSH BC */ \
+    X(0x147, 0x020) /* BIT 0,A, JR NZ,e8 */ \
+    X(0x147, 0x028) /* BIT 0,A, JR Z,e8 */ \
+    X(0x14F, 0x020) /* BIT 1,A, JR NZ,e8 */ \
+    X(0x14F, 0x028) /* BIT 1,A, JR Z,e8 */ \
+    X(0x157, 0x020) /* BIT 2,A, JR NZ,e8 */ \
+    X(0x157, 0x028) /* BIT 2,A, JR Z,e8 */ \
+    X(0x15F, 0x020) /* BIT 3,A, JR NZ,e8 */ \
+    X(0x15F, 0x028) /* BIT 3,A, JR Z,e8 */ \
+    X(0x167, 0x020) /* BIT 4,A, JR NZ,e8 */ \
+    X(0x167, 0x028) /* BIT 4,A, JR Z,e8 */ \
+    X(0x16F, 0x020) /* BIT 5,A, JR NZ,e8 */ \
+    X(0x16F, 0x028) /* BIT 5,A, JR Z,e8 */ \
+    X(0x177, 0x020) /* BIT 6,A, JR NZ,e8 */ \
+    X(0x177, 0x028) /* BIT 6,A, JR Z,e8 */ \
+    X(0x17F, 0x020) /* BIT 7,A, JR NZ,e8 */ \
+    X(0x17F, 0x028) /* BIT 7,A, JR Z,e8 */
+
+#endif /* fusions_hpp */
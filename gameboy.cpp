@@ -0,0 +1,54 @@
+#include "gameboy.hpp"
+#include "jit.hpp"
+#include <SDL2/SDL.h>
+
+GameBoy::GameBoy(bool headless) : scheduler(*this), cpu(*this), mmu(*this), ppu(*this), apu(*this),
+                                  timer(*this), joypad(*this), debug(*this), headless(headless){
+}
+
+void GameBoy::reset(){
+    scheduler.reset();
+    scheduler.schedule(EVENT_FRAME, FRAME_CYCLES);
+    
+    mmu.reset();
+    cpu.reset();
+    ppu.reset();
+    apu.reset();
+    timer.reset();
+    joypad.reset();
+}
+
+bool GameBoy::loadROM(const std::string& path){
+    if(!mmu.readROM(path)){
+        return false;
+    }
+    
+    // MBC1 or MBC5, other types aren't supported yet
+    mmu.updateBanking();
+    return true;
+}
+
+bool GameBoy::loadNative(const std::string& path){
+#ifdef GB_JIT_ENABLED
+    if(mmu.jit()){
+        return mmu.jit()->load(path);
+    }
+    SDL_Log("Load a ROM before its native library %s", path.c_str());
+#else
+    SDL_Log("Native library %s needs a build with GB_JIT defined", path.c_str());
+#endif
+    return false;
+}
+
+void GameBoy::runFrame(){
+    while (!scheduler.frameComplete){
+        cpu.runUntil(scheduler.nextEvent());
+        cpu.handleInterrupts();
+    }
+    
+    scheduler.frameComplete = false;
+}
+
+void GameBoy::quit(){
+    ppu.quit();
+}
@@ -0,0 +1,54 @@
+#ifndef gameboy_hpp
+#define gameboy_hpp
+
+#include <string>
+#include "definitions.hpp"
+#include "scheduler.hpp"
+#include "cpu.hpp"
+#include "mmu.hpp"
+#include "ppu.hpp"
+#include "apu.hpp"
+#include "timer.hpp"
+#include "joypad.hpp"
+#include "debug.hpp"
+
+// One emulated machine. It owns every component, and the components reach each
+// other through it, so any number of them can run side by side, one per thread.
+class GameBoy{
+    
+public:
+    
+    Scheduler scheduler;
+    CPU cpu;
+    MMU mmu;
+    PPU ppu;
+    APU apu;
+    Timer timer;
+    JOYPAD joypad;
+    Debug debug;
+    
+    // No window or audio device, the screen is only kept in PPU::screen()
+    const bool headless;
+    
+    explicit GameBoy(bool headless = false);
+    GameBoy(const GameBoy&) = delete;
+    GameBoy& operator=(const GameBoy&) = delete;
+    
+    // Powers on every component, the ROM is loaded afterwards
+    void reset();
+    
+    // Logs why through SDL_Log and returns false if the ROM can't be loaded
+    bool loadROM(const std::string& path);
+    
+    // Runs the ROM's blocks from a library built from Recompiler output, shared with every
+    // machine running the ROM. Needs GB_JIT, logs why through SDL_Log and returns false if
+    // the library can't be used.
+    bool loadNative(const std::string& path);
+    
+    // Runs up to each scheduled event in turn until the frame is done
+    void runFrame();
+    
+    void quit();
+};
+
+#endif /* gameboy_hpp */
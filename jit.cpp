@@ -0,0 +1,536 @@
+#include "jit.hpp"
+
+BlockExtent measureBlock(const DecodedInstruction* instruction, int bankOffset){
+    BlockExtent extent = {};
+    int lastCycles = 0;
+    while(extent.count < JIT_BLOCK_LENGTH && bankOffset + extent.length < ROM_BANK_SIZE && instruction[extent.length].length){
+        const DecodedInstruction& next = instruction[extent.length];
+        const OpcodeInfo& info = instructionInfo(next);
+        
+        extent.lastOffset = extent.length;
+        extent.leadCycles += lastCycles;
+        lastCycles = info.cycles;
+        extent.length += next.length;
+        extent.count++;
+        
+        if(info.endsBlock){
+            extent.ended = true;
+            break;
+        }
+    }
+    return extent;
+}
+
+// Register loads, 16-bit INC/DEC and the 8-bit ALU on registers and immediates. ADC and
+// SBC read the carry, and (HL) is memory, so those call their handlers.
+InlineOp classifyInline(const DecodedInstruction& instruction){
+    InlineOp op = {INLINE_NONE, 0, -1};
+    if(instruction.handler >= 0x100){
+        return op;
+    }
+    
+    BYTE opcode = (BYTE) instruction.handler;
+    int x = opcode >> 6;
+    int y = (opcode >> 3) & 0x7;
+    int z = opcode & 0x7;
+    int p = y >> 1;
+    int q = y & 0x1;
+    
+    if(opcode == 0x00){
+        op.kind = INLINE_NOP;
+    }
+    else if(x == 1 && y != 6 && z != 6){
+        op = {INLINE_LD_R_R, y, z};
+    }
+    else if(x == 0 && z == 6 && y != 6){
+        op = {INLINE_LD_R_N8, y, -1};
+    }
+    else if(x == 0 && z == 1 && q == 0){
+        op = {INLINE_LD_RR_N16, p, -1};
+    }
+    else if(x == 0 && z == 3){
+        op = {q == 0 ? INLINE_INC_RR : INLINE_DEC_RR, p, -1};
+    }
+    else if(x == 0 && (z == 4 || z == 5) && y != 6){
+        op = {z == 4 ? INLINE_INC_R : INLINE_DEC_R, y, -1};
+    }
+    else if(((x == 2 && z != 6) || (x == 3 && z == 6)) && y != 1 && y != 3){
+        static const InlineKind alu[8] = {INLINE_ADD, INLINE_NONE, INLINE_SUB, INLINE_NONE, INLINE_AND, INLINE_XOR, INLINE_OR, INLINE_CP};
+        op = {alu[y], 7, x == 3 ? -1 : z};
+    }
+    return op;
+}
+
+#ifdef GB_JIT_ENABLED
+
+#include "cpu.hpp"
+#include "isa.hpp"
+#include "romImage.hpp"
+#include <SDL2/SDL.h>
+#include <cstddef>
+#include <cstring>
+#include <dlfcn.h>
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+JIT::JIT(const ROMImage& rom) : rom(rom), decoded(rom.decodedBank(0)), bankCount(rom.bankCount()){
+    banks.reset(new std::atomic<std::atomic<const CompiledBlock*>*>[bankCount]);
+    for(int i = 0; i < bankCount; i++){
+        banks[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+JIT::~JIT(){
+    for(BYTE* chunk : chunks){
+        munmap(chunk, JIT_CODE_CHUNK);
+    }
+    for(void* library : libraries){
+        dlclose(library);
+    }
+}
+
+// Blocks that aren't compiled are kept too, with no code, so they aren't tried again
+const CompiledBlock* JIT::compile(const DecodedInstruction* instruction, WORD start){
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    const CompiledBlock* existing = find(instruction);
+    if(existing){
+        return existing;
+    }
+    
+    size_t at = offset(instruction);
+    BlockExtent extent = measureBlock(instruction, (int) (at % ROM_BANK_SIZE));
+    
+    std::unique_ptr<CompiledBlock> block(new CompiledBlock());
+    block->start = start;
+    block->end = start + extent.length;
+    block->last = start + extent.lastOffset;
+    block->leadCycles = extent.leadCycles;
+    
+    // Data ControlFlow found is only ever interpreted, should it be run
+    bool worthCompiling = extent.count >= JIT_BLOCK_MIN_LENGTH && !rom.controlFlow().isData(at);
+    block->code = worthCompiling ? emit(instruction, extent.count, start) : nullptr;
+    return store(at, std::move(block));
+}
+
+// Called with the mutex held. A block already at the offset is replaced but kept, as it may
+// still be running.
+const CompiledBlock* JIT::store(size_t at, std::unique_ptr<CompiledBlock> block){
+    int bank = (int) (at / ROM_BANK_SIZE);
+    std::atomic<const CompiledBlock*>* table = banks[bank].load(std::memory_order_relaxed);
+    if(!table){
+        table = new std::atomic<const CompiledBlock*>[ROM_BANK_SIZE];
+        for(int i = 0; i < ROM_BANK_SIZE; i++){
+            table[i].store(nullptr, std::memory_order_relaxed);
+        }
+        bankTables.emplace_back(table);
+        banks[bank].store(table, std::memory_order_release);
+    }
+    
+    const CompiledBlock* compiled = block.get();
+    blocks.push_back(std::move(block));
+    table[at % ROM_BANK_SIZE].store(compiled, std::memory_order_release);
+    return compiled;
+}
+
+bool JIT::load(const std::string& path){
+    void* library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if(!library){
+        SDL_Log("Could not load native library %s: %s", path.c_str(), dlerror());
+        return false;
+    }
+    
+    NativeLibrary* native = (NativeLibrary*) dlsym(library, NATIVE_LIBRARY_SYMBOL);
+    const char* problem = nullptr;
+    if(!native || native->version != NATIVE_LIBRARY_VERSION){
+        problem = "isn't a native library for this version";
+    }
+    else if(strncmp(native->buildID, buildID(), sizeof(native->buildID)) != 0){
+        problem = "is from another build";
+    }
+    else if(memcmp(native->romHash, rom.sha1(), sizeof(native->romHash)) != 0){
+        problem = "is for another ROM";
+    }
+    if(problem){
+        SDL_Log("Native library %s %s", path.c_str(), problem);
+        dlclose(library);
+        return false;
+    }
+    
+    native->handlers = CPU::compiledHandlerTable;
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    libraries.push_back(library);
+    for(uint32_t i = 0; i < native->blockCount; i++){
+        const NativeBlock& nativeBlock = native->blocks[i];
+        if(nativeBlock.offset >= (size_t) bankCount * ROM_BANK_SIZE){
+            continue;
+        }
+        
+        std::unique_ptr<CompiledBlock> block(new CompiledBlock());
+        block->code = nativeBlock.code;
+        block->start = nativeBlock.start;
+        block->end = nativeBlock.end;
+        block->last = nativeBlock.last;
+        block->leadCycles = nativeBlock.leadCycles;
+        store(nativeBlock.offset, std::move(block));
+    }
+    return true;
+}
+
+std::vector<CachedBlock> JIT::hotBlocks(){
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    std::vector<CachedBlock> hot;
+    for(int bank = 0; bank < bankCount; bank++){
+        std::atomic<const CompiledBlock*>* table = banks[bank].load(std::memory_order_relaxed);
+        if(!table){
+            continue;
+        }
+        for(int i = 0; i < ROM_BANK_SIZE; i++){
+            const CompiledBlock* block = table[i].load(std::memory_order_relaxed);
+            if(block && block->code){
+                hot.push_back({(uint32_t) (bank * ROM_BANK_SIZE + i), block->start, 0});
+            }
+        }
+    }
+    return hot;
+}
+
+#ifdef GB_JIT_X86_64
+
+// Host registers, by their x86 encoding
+enum HostRegister : BYTE{
+    EAX = 0,
+    ECX = 1,
+    EDX = 2
+};
+
+// x86-64 machine code for a block's function, System V calling convention. rbx holds the
+// CPU, r12 the registers and r13 the cycle count, callee saved so they live across calls.
+// Guest registers are only ever addressed as [r12 + offset].
+class Assembler{
+    
+    std::vector<BYTE> bytes;
+    
+    void bytesOf(const void* source, size_t length){
+        const BYTE* b = (const BYTE*) source;
+        bytes.insert(bytes.end(), b, b + length);
+    }
+    
+    // ModRM and SIB for [r12 + disp32], reg being the register or opcode extension
+    void registers(int reg, int offset){
+        byte(0x84 | (reg << 3));
+        byte(0x24);
+        dword(offset);
+    }
+    
+public:
+    
+    size_t size() const { return bytes.size(); }
+    const BYTE* data() const { return bytes.data(); }
+    
+    void byte(BYTE b){ bytes.push_back(b); }
+    void word(uint16_t w){ bytesOf(&w, 2); }
+    void dword(uint32_t d){ bytesOf(&d, 4); }
+    void qword(uint64_t q){ bytesOf(&q, 8); }
+    
+    // Jumps are emitted with no target, then pointed at the current position
+    size_t jump8(BYTE opcode){ byte(opcode); byte(0); return size() - 1; }
+    void bind8(size_t at){ bytes[at] = (BYTE) (size() - (at + 1)); }
+    void bind32(size_t at){ uint32_t d = (uint32_t) (size() - (at + 4)); memcpy(&bytes[at], &d, 4); }
+    
+    // movzx reg, byte [r12 + offset]
+    void load8(HostRegister reg, int offset){ byte(0x41); byte(0x0F); byte(0xB6); registers(reg, offset); }
+    
+    // mov byte [r12 + offset], reg
+    void store8(int offset, HostRegister reg){ byte(0x41); byte(0x88); registers(reg, offset); }
+    
+    // mov byte [r12 + offset], imm8 / mov word [r12 + offset], imm16
+    void store8(int offset, BYTE value){ byte(0x41); byte(0xC6); registers(0, offset); byte(value); }
+    void store16(int offset, WORD value){ byte(0x66); byte(0x41); byte(0xC7); registers(0, offset); word(value); }
+    
+    // inc word [r12 + offset] / dec word [r12 + offset]
+    void increment16(int offset){ byte(0x66); byte(0x41); byte(0xFF); registers(0, offset); }
+    void decrement16(int offset){ byte(0x66); byte(0x41); byte(0xFF); registers(1, offset); }
+    
+    // cmp byte [r12 + offset], imm8
+    void compare8(int offset, BYTE value){ byte(0x41); byte(0x80); registers(7, offset); byte(value); }
+    
+    // setcc byte [r12 + offset]
+    void setCondition(BYTE condition, int offset){ byte(0x41); byte(0x0F); byte(0x90 | condition); registers(0, offset); }
+    
+    // add dword [r12 + offset], imm32 / add dword [r13], imm32 / add ..., eax
+    void addRegisters(int offset, int value){ byte(0x41); byte(0x81); registers(0, offset); dword(value); }
+    void addCycles(int value){ byte(0x41); byte(0x81); byte(0x45); byte(0x00); dword(value); }
+    void addRegisters(int offset){ byte(0x41); byte(0x01); registers(EAX, offset); }
+    void addCycles(){ byte(0x41); byte(0x01); byte(0x45); byte(0x00); }
+};
+
+// x86 condition codes for setcc
+#define CONDITION_BELOW 0x2
+#define CONDITION_ABOVE 0x7
+
+// Where the guest registers are in Registers, in opcode encoding order
+static int reg8Offset(int r){
+    return (int) offsetof(Registers, r8) + registerIndex(r);
+}
+
+static int reg16Offset(int p){
+    return p == 3 ? (int) offsetof(Registers, SP) : (int) offsetof(Registers, r16) + p * 2;
+}
+
+// Records a lazy flag result the way CPU::setFlags() does, left and result in eax and edx.
+// The carry is already in place.
+static void emitFlags(Assembler& a, BYTE op, bool rightFromECX, BYTE right){
+    a.store8((int) offsetof(Registers, flagOp), op);
+    a.store8((int) offsetof(Registers, flagLeft), EAX);
+    if(rightFromECX){
+        a.store8((int) offsetof(Registers, flagRight), ECX);
+    }
+    else{
+        a.store8((int) offsetof(Registers, flagRight), right);
+    }
+    a.store8((int) offsetof(Registers, flagResult), EDX);
+}
+
+// Writes out what classifyInline() picks instead of calling its handler. Returns false,
+// having emitted nothing, for anything else.
+static bool emitInline(Assembler& a, const DecodedInstruction& instruction){
+    InlineOp op = classifyInline(instruction);
+    switch(op.kind){
+        case INLINE_NONE:
+            return false;
+            
+        case INLINE_NOP:
+            return true;
+            
+        case INLINE_LD_R_R:
+            a.load8(EAX, reg8Offset(op.source));
+            a.store8(reg8Offset(op.target), EAX);
+            return true;
+            
+        case INLINE_LD_R_N8:
+            a.store8(reg8Offset(op.target), (BYTE) instruction.operand);
+            return true;
+            
+        case INLINE_LD_RR_N16:
+            a.store16(reg16Offset(op.target), instruction.operand);
+            return true;
+            
+        case INLINE_INC_RR:
+            a.increment16(reg16Offset(op.target));
+            return true;
+            
+        case INLINE_DEC_RR:
+            a.decrement16(reg16Offset(op.target));
+            return true;
+            
+        // Keep the carry, which may still be pending, see CPU::carryFlag()
+        case INLINE_INC_R:
+        case INLINE_DEC_R:{
+            bool increment = op.kind == INLINE_INC_R;
+            a.load8(EAX, reg8Offset(op.target));
+            
+            // lea edx, [rax + 1] / lea edx, [rax - 1]
+            a.byte(0x8D); a.byte(0x50); a.byte(increment ? 0x01 : 0xFF);
+            a.store8(reg8Offset(op.target), EDX);
+            
+            a.compare8((int) offsetof(Registers, flagOp), FLAGS_NONE);
+            size_t none = a.jump8(0x74);
+            a.load8(ECX, (int) offsetof(Registers, flagCarry));
+            size_t done = a.jump8(0xEB);
+            a.bind8(none);
+            
+            // movzx ecx, F / shr ecx, 4 / and ecx, 1
+            a.load8(ECX, reg8Offset(6));
+            a.byte(0xC1); a.byte(0xE9); a.byte(0x04);
+            a.byte(0x83); a.byte(0xE1); a.byte(0x01);
+            a.bind8(done);
+            
+            a.store8((int) offsetof(Registers, flagCarry), ECX);
+            emitFlags(a, increment ? FLAGS_ADD : FLAGS_SUB, false, 1);
+            return true;
+        }
+            
+        default:
+            break;
+    }
+    
+    // ADD, SUB, AND, XOR, OR and CP, A with a register or an immediate
+    a.load8(EAX, reg8Offset(7));
+    if(op.source < 0){
+        // mov ecx, imm32
+        a.byte(0xB9); a.dword((BYTE) instruction.operand);
+    }
+    else{
+        a.load8(ECX, reg8Offset(op.source));
+    }
+    
+    if(op.kind == INLINE_ADD){
+        // lea edx, [rax + rcx] / cmp edx, 0xFF
+        a.byte(0x8D); a.byte(0x14); a.byte(0x08);
+        a.store8(reg8Offset(7), EDX);
+        a.byte(0x81); a.byte(0xFA); a.dword(0xFF);
+        a.setCondition(CONDITION_ABOVE, (int) offsetof(Registers, flagCarry));
+        emitFlags(a, FLAGS_ADD, true, 0);
+    }
+    else if(op.kind == INLINE_SUB || op.kind == INLINE_CP){
+        // mov edx, eax / sub edx, ecx / cmp eax, ecx
+        a.byte(0x89); a.byte(0xC2);
+        a.byte(0x29); a.byte(0xCA);
+        if(op.kind == INLINE_SUB){
+            a.store8(reg8Offset(7), EDX);
+        }
+        a.byte(0x39); a.byte(0xC8);
+        a.setCondition(CONDITION_BELOW, (int) offsetof(Registers, flagCarry));
+        emitFlags(a, FLAGS_SUB, true, 0);
+    }
+    else{
+        // mov edx, eax / and, xor or or edx, ecx
+        a.byte(0x89); a.byte(0xC2);
+        a.byte(op.kind == INLINE_AND ? 0x21 : op.kind == INLINE_XOR ? 0x31 : 0x09); a.byte(0xCA);
+        a.store8(reg8Offset(7), EDX);
+        a.store8((int) offsetof(Registers, flagCarry), (BYTE) 0);
+        
+        // As in CPU::CPU_AND() and friends, the operands aren't kept
+        a.byte(0x31); a.byte(0xC0);
+        emitFlags(a, op.kind == INLINE_AND ? FLAGS_AND : FLAGS_OR, false, 0);
+    }
+    return true;
+}
+
+// Each instruction is either written out inline or its handler is called with the CPU and
+// the operand, PC having been moved past it first. Cycles of inline instructions are added
+// up and only added to the counts before the next call, when they may be looked at. After
+// a call that touched memory the block stops if an exit was requested, the same as
+// CPU::runUntil() would.
+CompiledCode JIT::emit(const DecodedInstruction* instructions, int count, WORD start){
+    const int pcOffset = (int) offsetof(Registers, PC);
+    const int pendingOffset = (int) offsetof(Registers, pendingCycles);
+    const int exitOffset = (int) offsetof(Registers, exitRequested);
+    
+    Assembler a;
+    std::vector<size_t> exits;
+    int inlineCycles = 0;
+    bool called = false;
+    
+    // push rbx / push r12 / push r13, which also aligns the stack for the calls
+    a.byte(0x53);
+    a.byte(0x41); a.byte(0x54);
+    a.byte(0x41); a.byte(0x55);
+    
+    // mov rbx, rdi / mov r12, rsi / mov r13, rdx
+    a.byte(0x48); a.byte(0x89); a.byte(0xFB);
+    a.byte(0x49); a.byte(0x89); a.byte(0xF4);
+    a.byte(0x49); a.byte(0x89); a.byte(0xD5);
+    
+    WORD pc = start;
+    for(int i = 0; i < count; i++){
+        const DecodedInstruction& instruction = instructions[pc - start];
+        const OpcodeInfo& info = instructionInfo(instruction);
+        pc += instruction.length;
+        
+        if(emitInline(a, instruction)){
+            inlineCycles += info.cycles;
+            called = false;
+            continue;
+        }
+        
+        if(inlineCycles){
+            a.addCycles(inlineCycles);
+            a.addRegisters(pendingOffset, inlineCycles);
+            inlineCycles = 0;
+        }
+        a.store16(pcOffset, pc);
+        
+        // mov rdi, rbx / mov esi, operand / mov rax, handler / call rax
+        a.byte(0x48); a.byte(0x89); a.byte(0xDF);
+        a.byte(0xBE); a.dword(instruction.operand);
+        a.byte(0x48); a.byte(0xB8); a.qword((uint64_t) CPU::compiledHandlerTable[instruction.handler]);
+        a.byte(0xFF); a.byte(0xD0);
+        
+        a.addCycles();
+        a.addRegisters(pendingOffset);
+        called = true;
+        
+        // jne exit
+        if(i < count - 1 && info.memory != MEMORY_NONE){
+            a.compare8(exitOffset, 0);
+            a.byte(0x0F); a.byte(0x85);
+            exits.push_back(a.size());
+            a.dword(0);
+        }
+    }
+    
+    if(inlineCycles){
+        a.addCycles(inlineCycles);
+        a.addRegisters(pendingOffset, inlineCycles);
+    }
+    if(!called){
+        a.store16(pcOffset, pc);
+    }
+    
+    // mov eax, 1 / jmp past the early exit
+    a.byte(0xB8); a.dword(1);
+    size_t done = a.jump8(0xEB);
+    
+    // xor eax, eax
+    for(size_t at : exits){
+        a.bind32(at);
+    }
+    a.byte(0x31); a.byte(0xC0);
+    a.bind8(done);
+    
+    // pop r13 / pop r12 / pop rbx / ret
+    a.byte(0x41); a.byte(0x5D);
+    a.byte(0x41); a.byte(0x5C);
+    a.byte(0x5B);
+    a.byte(0xC3);
+    
+    BYTE* code = allocate(a.size());
+    if(!code){
+        return nullptr;
+    }
+    memcpy(code, a.data(), a.size());
+    return (CompiledCode) code;
+}
+
+// Code only goes into memory no block is running from yet, so it's written in place
+BYTE* JIT::allocate(size_t length){
+    if(length > JIT_CODE_CHUNK){
+        return nullptr;
+    }
+    
+    if(chunkUsed + length > JIT_CODE_CHUNK){
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_JIT
+        flags |= MAP_JIT;
+#endif
+        void* chunk = mmap(nullptr, JIT_CODE_CHUNK, PROT_READ | PROT_WRITE | PROT_EXEC, flags, -1, 0);
+        if(chunk == MAP_FAILED){
+            SDL_Log("Could not map memory for compiled code, interpreting instead");
+            return nullptr;
+        }
+        chunks.push_back((BYTE*) chunk);
+        chunkUsed = 0;
+    }
+    
+    BYTE* code = chunks.back() + chunkUsed;
+    chunkUsed = (chunkUsed + length + 15) & ~(size_t) 15;
+    return code;
+}
+
+#else
+
+// Blocks only run from libraries
+CompiledCode JIT::emit(const DecodedInstruction*, int, WORD){
+    return nullptr;
+}
+
+#endif
+
+#endif
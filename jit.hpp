@@ -0,0 +1,152 @@
+#ifndef jit_hpp
+#define jit_hpp
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "definitions.hpp"
+#include "controlFlow.hpp"
+#include "isa.hpp"
+#include "native.hpp"
+#include "registers.hpp"
+#include "romImage.hpp"
+#include "translationCache.hpp"
+
+// Jumps to a block start before it's compiled
+#define JIT_HOT_VISITS 16
+
+// Fewest and most instructions in one block. A single instruction runs no faster compiled.
+#define JIT_BLOCK_MIN_LENGTH 2
+#define JIT_BLOCK_LENGTH 64
+
+// Executable memory is taken from the system this much at a time
+#define JIT_CODE_CHUNK 0x100000
+
+struct CompiledBlock{
+    CompiledCode code;  // nullptr if the block isn't worth compiling or couldn't be
+    WORD start;         // PC of the first instruction
+    WORD end;           // PC after the last instruction
+    WORD last;          // PC of the last instruction
+    int leadCycles;     // every instruction's cycles but the last one's
+};
+
+// How far a block runs. It ends at the first instruction that ends one, the end of its bank,
+// an instruction running past it, or JIT_BLOCK_LENGTH instructions.
+struct BlockExtent{
+    int count;          // instructions
+    int length;         // bytes
+    int lastOffset;     // bytes from the start to the last instruction
+    int leadCycles;
+    bool ended;         // by an instruction that ends blocks, rather than a limit
+};
+
+// The block starting at a predecoded instruction, bankOffset into its bank
+BlockExtent measureBlock(const DecodedInstruction* instruction, int bankOffset);
+
+// Instructions written out in place of calling their handler, by the JIT and by the
+// recompiler alike. None touch memory or read PC.
+enum InlineKind{
+    INLINE_NONE,        // calls its handler
+    INLINE_NOP,
+    INLINE_LD_R_R,
+    INLINE_LD_R_N8,
+    INLINE_LD_RR_N16,
+    INLINE_INC_RR,
+    INLINE_DEC_RR,
+    INLINE_INC_R,
+    INLINE_DEC_R,
+    INLINE_ADD,
+    INLINE_SUB,
+    INLINE_AND,
+    INLINE_XOR,
+    INLINE_OR,
+    INLINE_CP
+};
+
+struct InlineOp{
+    InlineKind kind;
+    int target;         // register in opcode encoding order, or pair for LD/INC/DEC rr
+    int source;         // register for LD r,r' and the ALU, -1 for an immediate
+};
+
+// What a predecoded instruction is written out as, INLINE_NONE for anything that isn't
+InlineOp classifyInline(const DecodedInstruction& instruction);
+
+// Straight-line runs of ROM code compiled to x86-64, each ending at the first instruction
+// that can branch or change the interrupt state. Blocks are kept by ROM offset and shared
+// by every machine running the ROM, so they're only compiled once.
+//
+// Compiled code keeps the guest registers in Registers and the cycle count in
+// Registers::pendingCycles as it goes. NOP, LD r,r', LD r,n8, LD rr,n16, INC and DEC of a
+// register or register pair, and ADD, SUB, AND, XOR, OR and CP with a register or an
+// immediate are written out as x86 in place, see classifyInline(). Those have to leave the
+// lazy flags as CPU::setFlags() would. Everything else calls the interpreter's handler, so
+// only the inline ones can disagree with the interpreter. What it saves is the fetch,
+// decode and dispatch around every instruction.
+//
+// Blocks can also come from a ROM recompiled ahead of time, see JIT::load(). Those run
+// anywhere, not just on x86-64.
+class JIT{
+    
+    const ROMImage& rom;
+    
+    // The ROM's predecoded instructions, blocks are found by their offset into them
+    const DecodedInstruction* decoded;
+    int bankCount;
+    
+    // Taken while compiling, lookups don't
+    std::mutex mutex;
+    
+    // Block at each offset of each bank, the table for a bank made when it gets its first
+    std::unique_ptr<std::atomic<std::atomic<const CompiledBlock*>*>[]> banks;
+    std::vector<std::unique_ptr<CompiledBlock>> blocks;
+    std::vector<std::unique_ptr<std::atomic<const CompiledBlock*>[]>> bankTables;
+    
+    // Executable memory, filled from the start and never reused
+    std::vector<BYTE*> chunks;
+    size_t chunkUsed = JIT_CODE_CHUNK;
+    
+    // Libraries loaded, kept open as long as their blocks may run
+    std::vector<void*> libraries;
+    
+    const CompiledBlock* store(size_t at, std::unique_ptr<CompiledBlock> block);
+    CompiledCode emit(const DecodedInstruction* instructions, int count, WORD start);
+    BYTE* allocate(size_t length);
+    
+public:
+    
+    explicit JIT(const ROMImage& rom);
+    JIT(const JIT&) = delete;
+    JIT& operator=(const JIT&) = delete;
+    ~JIT();
+    
+    // Offset into the ROM of an instruction in its predecoded instructions
+    size_t offset(const DecodedInstruction* instruction) const { return instruction - decoded; }
+    
+    // The block starting at a predecoded instruction, or nullptr if it hasn't been compiled
+    const CompiledBlock* find(const DecodedInstruction* instruction) const{
+        size_t at = offset(instruction);
+        std::atomic<const CompiledBlock*>* table = banks[at / ROM_BANK_SIZE].load(std::memory_order_acquire);
+        return table ? table[at % ROM_BANK_SIZE].load(std::memory_order_acquire) : nullptr;
+    }
+    
+    // Block starts ControlFlow found are known to be code, so they're compiled the first time
+    // they're reached rather than once they're hot
+    bool isKnownBlock(const DecodedInstruction* instruction) const { return rom.controlFlow().isBlockStart(offset(instruction)); }
+    
+    // Compiles the block starting at a predecoded instruction, run from start. Returns the
+    // block already there if another machine got to it first.
+    const CompiledBlock* compile(const DecodedInstruction* instruction, WORD start);
+    
+    // Takes every block from a library the Recompiler's output was built into, in place of
+    // any compiled already. Logs why through SDL_Log and returns false if it's not for this
+    // ROM and this build.
+    bool load(const std::string& path);
+    
+    // Every block start with code, for the next run to compile as soon as it loads the ROM
+    std::vector<CachedBlock> hotBlocks();
+};
+
+#endif /* jit_hpp */
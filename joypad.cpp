@@ -1,4 +1,5 @@
 #include "joypad.hpp"
+#include "gameboy.hpp"
 #include "registers.hpp"
 
 BYTE JOYPAD::readByte(){
@@ -21,6 +22,9 @@ void JOYPAD::reset(){
     controls[0] = 0x0F;
     controls[1] = 0x0F;
     column = 0x0;
+    
+    gb.mmu.mapIO(0xFF00, [](GameBoy& gb, WORD){ return gb.joypad.readByte(); },
+                         [](GameBoy& gb, WORD, BYTE val){ gb.joypad.writeByte(val); });
 }
 
 void JOYPAD::keyDown(SDL_Keycode key){
@@ -62,7 +66,7 @@ void JOYPAD::keyDown(SDL_Keycode key){
     
     // Joypad Interrupt occurrs if key is pressed and column bit is enabled
     if((column & 0x10 && controls[1] != 0x0F) || (column & 0x20 && controls[0] != 0x0F)){
-        ifRegister |= 0x10;
+        gb.cpu.requestInterrupt(INTERRUPT_JOYPAD);
     }
 }
 
@@ -104,4 +108,17 @@ void JOYPAD::keyUp(SDL_Keycode key){
     }
 }
 
-JOYPAD joypad;
+void JOYPAD::setButtons(BYTE buttons){
+    BYTE directions = ~buttons & 0x0F;
+    BYTE actions = (~buttons >> 4) & 0x0F;
+    
+    // Bits going from 1 to 0
+    BYTE pressed[2] = {(BYTE) (controls[0] & ~directions), (BYTE) (controls[1] & ~actions)};
+    controls[0] = directions;
+    controls[1] = actions;
+    
+    // Same as keyDown(), but only for the newly pressed buttons
+    if((column & 0x10 && pressed[1]) || (column & 0x20 && pressed[0])){
+        gb.cpu.requestInterrupt(INTERRUPT_JOYPAD);
+    }
+}
@@ -4,20 +4,37 @@
 #include <SDL2/SDL.h>
 #include "definitions.hpp"
 
+// Bits of the byte passed to JOYPAD::setButtons(), set while held
+#define BUTTON_RIGHT 0x01
+#define BUTTON_LEFT 0x02
+#define BUTTON_UP 0x04
+#define BUTTON_DOWN 0x08
+#define BUTTON_A 0x10
+#define BUTTON_B 0x20
+#define BUTTON_SELECT 0x40
+#define BUTTON_START 0x80
+
+class GameBoy;
+
 class JOYPAD{
     
+    GameBoy& gb;
+    
     BYTE controls[2] = {0x0F, 0x0F};
     BYTE column = 0x0;
     
 public:
     
+    explicit JOYPAD(GameBoy& gb) : gb(gb){}
+    
     BYTE readByte();
     void writeByte(BYTE val);
     void reset();
     void keyDown(SDL_Keycode key);
     void keyUp(SDL_Keycode key);
+    
+    // Holds exactly the BUTTON_* bits given, releasing the rest
+    void setButtons(BYTE buttons);
 };
 
-extern JOYPAD joypad;
-
 #endif /* joypad_hpp */
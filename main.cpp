@@ -1,22 +1,182 @@
 #include "main.hpp"
 
+// Runs headless machines flat out and logs how many frames a second they manage
+static int runBatch(const char* path, int count, int frames, const char* native){
+    Batch batch;
+    if(!batch.create(path, count)){
+        return 1;
+    }
+    if(native && !batch.machine(0).loadNative(native)){
+        return 1;
+    }
+    
+    std::vector<BYTE> inputs(count, 0);
+    std::vector<BYTE> observations((size_t) count * OBSERVATION_LENGTH);
+    
+    auto startTime = std::chrono::steady_clock::now();
+    for(int i = 0; i < frames; i++){
+        batch.step(inputs.data(), 1, observations.data());
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    
+    SDL_Log("%d machines, %d frames in %.3fs, %.0f frames/s", count, frames, elapsed.count(),
+            (double) count * frames / elapsed.count());
+    return 0;
+}
+
+// Writes the ROM out as C++ to be built into a native library, see Recompiler
+static int recompile(const char* path, const char* output){
+    std::shared_ptr<const ROMImage> rom = ROMImage::open(path);
+    if(!rom){
+        return 1;
+    }
+    return Recompiler(*rom).write(output, path) ? 0 : 1;
+}
+
+// Lists the whole ROM as assembly, see writeDisassembly()
+static int disassembleROM(const char* path, const char* output){
+    std::shared_ptr<const ROMImage> rom = ROMImage::open(path);
+    if(!rom){
+        return 1;
+    }
+    return writeDisassembly(*rom, output) ? 0 : 1;
+}
+
+// Runs the ROM headless, interpreted, and adds how often each instruction ran after
+// another to the counts in output, see savePairCounts()
+static int countPairs(const char* path, int frames, const char* output){
+#ifdef GB_PAIR_PROFILE
+    std::unique_ptr<GameBoy> gameboy(new GameBoy(true));
+    gameboy->reset();
+    if(!gameboy->loadROM(path)){
+        return 1;
+    }
+#ifdef GB_JIT_ENABLED
+    gameboy->cpu.runsCompiled = false;
+#endif
+
+    for(int frame = 0; frame < frames; frame++){
+        gameboy->runFrame();
+    }
+    return savePairCounts(gameboy->cpu.pairCounts(), output) ? 0 : 1;
+#else
+    (void) path;
+    (void) frames;
+    (void) output;
+    SDL_Log("Counting opcode pairs needs a build with GB_PAIR_PROFILE defined");
+    return 1;
+#endif
+}
+
+// Where two machines that should be in step first differ, or nullptr if they don't
+static const char* difference(GameBoy& a, GameBoy& b){
+    a.cpu.materialiseFlags();
+    b.cpu.materialiseFlags();
+    const Registers& x = a.cpu.regs;
+    const Registers& y = b.cpu.regs;
+    
+    if(memcmp(x.r16, y.r16, sizeof(x.r16)) != 0 || x.SP.reg != y.SP.reg || x.PC != y.PC){
+        return "registers";
+    }
+    if(x.IME != y.IME || x.halt != y.halt || x.ifRegister != y.ifRegister || x.ieRegister != y.ieRegister){
+        return "interrupt state";
+    }
+    if(a.scheduler.now != b.scheduler.now){
+        return "cycle count";
+    }
+    
+    // Video RAM through work RAM, OAM and high RAM. I/O registers are left out, reading some
+    // of them isn't free of side effects.
+    const WORD ranges[][2] = {{0x8000, 0xDFFF}, {0xFE00, 0xFE9F}, {0xFF80, 0xFFFE}};
+    for(const auto& range : ranges){
+        for(int address = range[0]; address <= range[1]; address++){
+            if(a.mmu.readByte(address) != b.mmu.readByte(address)){
+                return "memory";
+            }
+        }
+    }
+    
+    if(memcmp(a.ppu.screen(), b.ppu.screen(), FRAME_BUFFER_LENGTH) != 0){
+        return "screen";
+    }
+    return nullptr;
+}
+
+// Runs the ROM interpreted and with a native library side by side, checking they agree
+// after every frame
+static int verify(const char* path, const char* native, int frames){
+    std::unique_ptr<GameBoy> reference(new GameBoy(true));
+    std::unique_ptr<GameBoy> compiled(new GameBoy(true));
+    reference->reset();
+    compiled->reset();
+    if(!reference->loadROM(path) || !compiled->loadROM(path) || !compiled->loadNative(native)){
+        return 1;
+    }
+
+#ifdef GB_JIT_ENABLED
+    reference->cpu.runsCompiled = false;
+#endif
+
+    for(int frame = 0; frame < frames; frame++){
+        reference->runFrame();
+        compiled->runFrame();
+        
+        const char* problem = difference(*reference, *compiled);
+        if(problem){
+            SDL_Log("%s differs from the interpreter in %s after frame %d, PC $%04X against $%04X",
+                    native, problem, frame, compiled->cpu.regs.PC, reference->cpu.regs.PC);
+            return 1;
+        }
+    }
+    
+    SDL_Log("%s matches the interpreter over %d frames", native, frames);
+    return 0;
+}
+
 int main(int argc, char *argv[]){
     
-    const int maxCycles = (CLOCKSPEED / 60);
-    int frameCycles = 0;
-    int clockCycles = 0;
+    // Options taking the rest of the command line
+    const char* native = nullptr;
+    if(argc >= 4 && std::string(argv[argc - 2]) == "--native"){
+        native = argv[argc - 1];
+        argc -= 2;
+    }
     
-    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+    if(argc == 5 && std::string(argv[2]) == "--batch"){
+        return runBatch(argv[1], atoi(argv[3]), atoi(argv[4]), native);
+    }
+    if(argc == 4 && std::string(argv[2]) == "--recompile"){
+        return recompile(argv[1], argv[3]);
+    }
+    if(argc == 4 && std::string(argv[2]) == "--disassemble"){
+        return disassembleROM(argv[1], argv[3]);
+    }
+    if(argc == 5 && std::string(argv[2]) == "--verify"){
+        return verify(argv[1], argv[3], atoi(argv[4]));
+    }
+    if(argc == 5 && std::string(argv[2]) == "--pairs"){
+        return countPairs(argv[1], atoi(argv[3]), argv[4]);
+    }
+    if(argc == 5 && std::string(argv[1]) == "--fusions"){
+        return writeFusions(argv[2], atoi(argv[3]), argv[4]) ? 0 : 1;
+    }
     
-    mmu.reset();
-    cpu.reset();
-    ppu.reset();
-    apu.reset();
+    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
     
-    mmu.readROM(argv[1]);
+    // Too big for the stack
+    std::unique_ptr<GameBoy> gameboy(new GameBoy());
+    gameboy->reset();
     
-    // Check if MBC1 or not. Other types not supported (yet).
-    mmu.updateBanking();
+    if(argc < 2){
+        SDL_Log("Usage: %s <rom> [--batch <machines> <frames> | --recompile <output.cpp> | --disassemble <output.asm> | --verify <library> <frames> | --pairs <frames> <counts>] [--native <library>]", argv[0]);
+        SDL_Log("       %s --fusions <counts> <count> <fusions.hpp>", argv[0]);
+        gameboy->quit();
+        return 1;
+    }
+    if(!gameboy->loadROM(argv[1]) || (native && !gameboy->loadNative(native))){
+        gameboy->quit();
+        return 1;
+    }
     
     SDL_Event e;
     bool quit = false;
@@ -27,10 +187,10 @@ int main(int argc, char *argv[]){
                 case SDL_QUIT:
                     quit = true; break;
                 case SDL_KEYDOWN:
-                    joypad.keyDown(e.key.keysym.sym);
+                    gameboy->joypad.keyDown(e.key.keysym.sym);
                     break;
                 case SDL_KEYUP:
-                    joypad.keyUp(e.key.keysym.sym);
+                    gameboy->joypad.keyUp(e.key.keysym.sym);
                     break;
                 default:
                     break;
@@ -40,18 +200,7 @@ int main(int argc, char *argv[]){
         // Remnant of controlling CPU pacing, sound now implicitly controls this. May change in the future.
         //auto startTime = std::chrono::system_clock::now();
         
-        while (frameCycles < maxCycles){
-            clockCycles = cpu.step();
-            frameCycles += clockCycles;
-            cpu.addToClock(clockCycles);
-            ppu.addToClock(clockCycles);
-            timer.addToClock(clockCycles);
-            ppu.step();
-            apu.step(clockCycles);
-            cpu.handleInterrupts();
-        }
-        
-        frameCycles %= maxCycles;
+        gameboy->runFrame();
         
         // Remnant of controlling CPU pacing, sound now implicitly controls this. May change in the future.
         //        auto endTime = std::chrono::system_clock::now();
@@ -62,7 +211,7 @@ int main(int argc, char *argv[]){
         //        if (diff < frameCap){
         //            std::this_thread::sleep_for(frameCap - diff);
         //        }
-        
+    
     }
-    ppu.quit();
+    gameboy->quit();
 }
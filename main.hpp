@@ -3,16 +3,16 @@
 
 #include <thread>
 #include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
 #include <SDL2/SDL.h>
 #include "definitions.hpp"
-#include "registers.hpp"
-#include "joypad.hpp"
-#include "bitOperations.hpp"
-#include "sprite.hpp"
-#include "timer.hpp"
-#include "apu.hpp"
-#include "mmu.hpp"
-#include "cpu.hpp"
-#include "ppu.hpp"
+#include "gameboy.hpp"
+#include "batch.hpp"
+#include "disassembler.hpp"
+#include "fusionProfile.hpp"
+#include "recompiler.hpp"
 
 #endif /* main_hpp */
@@ -1,4 +1,5 @@
 #include "mmu.hpp"
+#include "gameboy.hpp"
 
 void MMU::updateTileSet(WORD addr){
     // Every pixel is 2 rows and we'll start indexing from 0
@@ -66,28 +67,129 @@ void MMU::dmaTransfer(const BYTE& val) {
 
 
 void MMU::reset(){
-    memset(&memory, 0, GAMEBOY_MEMORY);
-    memset(&cartridgeMemory, 0, MAX_MEMORY);
+    memset(&memory, 0, sizeof(memory));
     memset(&ramMemory, 0, sizeof(ramMemory));
+    mapPages();
+    
+    // The other devices map their registers in their own reset()
+    for(int i = 0; i < 256; i++){
+        ioReads[i] = nullptr;
+        ioWrites[i] = nullptr;
+    }
+    
+    // DMA, the source register reads back as written
+    mapIO(0xFF46, nullptr, [](GameBoy& gb, WORD address, BYTE val){
+        gb.mmu.dmaTransfer(val);
+        gb.mmu.memory[address - MEMORY_START] = val;
+    });
+    mapIO(0xFF47, nullptr, [](GameBoy& gb, WORD, BYTE val){ gb.mmu.setPalette(gb.mmu.palette, val); });
+    mapIO(0xFF48, nullptr, [](GameBoy& gb, WORD, BYTE val){ gb.mmu.setPalette(gb.mmu.obj0Palette, val); });
+    mapIO(0xFF49, nullptr, [](GameBoy& gb, WORD, BYTE val){ gb.mmu.setPalette(gb.mmu.obj1Palette, val); });
+    mapIO(0xFF50, nullptr, [](GameBoy& gb, WORD, BYTE){
+        gb.mmu.inBIOS = false;
+        gb.mmu.mapBanks();
+    });
+}
+
+// Either handler may be nullptr, the register is then plain memory that way
+void MMU::mapIO(WORD address, IORead read, IOWrite write){
+    ioReads[address & 0xFF] = read;
+    ioWrites[address & 0xFF] = write;
+}
+
+// Plain memory is read and written straight through the page table. Writes to ROM (MBC
+// registers), the tile data (tile set decode) and OAM (sprite decode), and the I/O page
+// always take the slow path.
+void MMU::mapPages(){
+    for(int page = 0; page < 256; page++){
+        readPages[page] = nullptr;
+        writePages[page] = nullptr;
+    }
+    
+    // VRAM, only the tile maps are plain for writes
+    for(int page = 0x80; page < 0xA0; page++){
+        readPages[page] = &memory[(page << 8) - MEMORY_START];
+        if(page >= 0x98){
+            writePages[page] = &memory[(page << 8) - MEMORY_START];
+        }
+    }
+    
+    // WRAM, and echo RAM aliasing it
+    for(int page = 0xC0; page < 0xE0; page++){
+        readPages[page] = writePages[page] = &memory[(page << 8) - MEMORY_START];
+    }
+    for(int page = 0xE0; page < 0xFE; page++){
+        readPages[page] = writePages[page] = &memory[((page - 0x20) << 8) - MEMORY_START];
+    }
+    
+    // OAM and the unusable area after it
+    readPages[0xFE] = &memory[0xFE00 - MEMORY_START];
+    
+    mapBanks();
+}
+
+// Repoints the pages that depend on the boot ROM and the MBC registers
+void MMU::mapBanks(){
+    // Reads of ROM take the slow path until one is loaded
+    for(int page = 0x00; page < 0x80; page++){
+        decodedPages[page] = nullptr;
+    }
+    if(rom){
+        for(int page = 0x00; page < 0x40; page++){
+            readPages[page] = rom->bank(0) + (page << 8);
+            decodedPages[page] = rom->decodedBank(0) + (page << 8);
+        }
+        for(int page = 0x40; page < 0x80; page++){
+            readPages[page] = rom->bank(romBankNumber) + ((page - 0x40) << 8);
+            decodedPages[page] = rom->decodedBank(romBankNumber) + ((page - 0x40) << 8);
+        }
+    }
+    if(inBIOS){
+        readPages[0x00] = bootROM;
+        decodedPages[0x00] = nullptr;
+    }
+    for(int page = 0xA0; page < 0xC0; page++){
+        BYTE* ram = &ramMemory[((page - 0xA0) << 8) + (ramBankNumber * 0x2000)];
+        readPages[page] = ram;
+        writePages[page] = ramEnabled ? ram : nullptr;
+    }
 }
 
 void MMU::updateBanking(){
-    switch(cartridgeMemory[0x147]){
+    switch(rom->type()){
         case 1  : mbc1 = true; break;
         case 2  : mbc1 = true; break;
         case 3  : mbc1 = true; break;
         default : mbc1 = false; break;
     }
+    
+    // With or without RAM, battery and rumble
+    mbc5 = rom->type() >= 0x19 && rom->type() <= 0x1E;
 }
 
 void MMU::handleBanking(WORD address, BYTE val){
-    if(!mbc1){
+    if(!mbc1 && !mbc5){
         return;
     }
     
+    WORD previousBank = romBankNumber;
+    
     if(address < 0x2000){
         ramEnabled = (val & 0x0F) == 0x0A;
     }
+    else if(mbc5){
+        // A 9 bit bank number, and bank 0 can be switched in as well
+        if(address < 0x3000){
+            romBankNumber = (romBankNumber & 0x100) | val;
+        }
+        else if(address < 0x4000){
+            romBankNumber = ((val & 0x1) << 8) | (romBankNumber & 0xFF);
+        }
+        else if(address < 0x6000){
+            // Bit 3 drives the motor on a rumble cartridge
+            ramBankNumber = val & (rom->type() >= 0x1C ? 0x07 : 0x0F);
+        }
+    }
     else if(address < 0x4000){
         val = (romBankNumber & 0xE0) | (val & 0x1F);
         switch(val){
@@ -118,193 +220,87 @@ void MMU::handleBanking(WORD address, BYTE val){
         }
     }
     
+    // Neither a compiled block nor a superinstruction can see the bank it's running from
+    // being switched
+    if(romBankNumber != previousBank && gb.cpu.regs.PC >= 0x4000 && gb.cpu.regs.PC < 0x8000){
+        gb.cpu.regs.exitRequested = true;
+    }
+    mapBanks();
+}
+
+// I/O registers, the devices behind them are caught up before they're touched
+static inline bool isIORegister(WORD address){
+    return address >= 0xFF00 && (address < 0xFF80 || address == 0xFFFF);
 }
 
 BYTE MMU::readByte(WORD address){
     
-    if(inBIOS && address < 0x100){
-        return bootROM[address];
-    }
-    else if(address < 0x4000){
-        return cartridgeMemory[address];
-    }
-    else if (address >= 0x4000 && address <= 0x7FFF){
-        return cartridgeMemory[(address - 0x4000) + (romBankNumber * 0x4000)];
-    }
-    else if(address >= 0xA000 && address <= 0xBFFF){
-        return ramMemory[(address - 0xA000) + (ramBankNumber * 0x2000)];
-    }
-    else if (address == 0xFF00){
-        return joypad.readByte();
-    }
-    else if(address == 0xFF04){
-        return timer.divider;
-    }
-    else if(address == 0xFF05){
-        return timer.counter;
-    }
-    else if(address == 0xFF06){
-        return timer.modulo;
-    }
-    else if(address == 0xFF07){
-        return timer.control & 0x3;
-    }
-    else if((address >= 0xFF10 && address <= 0xFF3F) &&
-            !(address >= 0xFF27 && address <= 0xFF2F)){
-        return apu.readByte(address);
-    }
-    else if(address == 0xFF40){
-        return (switchBG      ? 0x01 : 0x00) |
-        (switchOBJ     ? 0x02 : 0x00) |
-        (spriteDoubled ? 0x04 : 0x00) |
-        (bgMap         ? 0x08 : 0x00) |
-        (bgTile        ? 0x10 : 0x00) |
-        (switchWindow  ? 0x20 : 0x00) |
-        (windowTile    ? 0x40 : 0x00) |
-        (switchLCD     ? 0x80 : 0x00);
-    }
-    else if(address == 0xFF41){
-        return lcdStatRegister;
-    }
-    else if(address == 0xFF42){
-        return scrollY;
-    }
-    else if(address == 0xFF43){
-        return scrollX;
-    }
-    else if(address == 0xFF44){
-        return line;
+    const BYTE* page = readPages[address >> 8];
+    if(page){
+        return page[address & 0xFF];
     }
-    else if (address == 0xFF4A){
-        return windowY;
-    }
-    else if (address == 0xFF4B){
-        return windowX;
+    
+    // No ROM loaded
+    if(address < 0xFF00){
+        return 0xFF;
     }
-    else if(address == 0xFF0F){
-        return ifRegister;
+    
+    // I/O page
+    if(isIORegister(address)){
+        gb.cpu.ioAccess();
     }
-    else if(address == 0xFFFF){
-        return ieRegister;
+    
+    IORead read = ioReads[address & 0xFF];
+    if(read){
+        return read(gb, address);
     }
     
-    return memory[address];
+    return memory[address - MEMORY_START];
 }
 
 void MMU::writeByte(WORD address, BYTE val){
-    if(address >= 0xFEA0 && address <= 0xFEFF){
+    
+    BYTE* page = writePages[address >> 8];
+    if(page){
+        page[address & 0xFF] = val;
         return;
     }
-    else if(address < 0x8000){
+    
+    if(address < 0x8000){
         handleBanking(address, val);
+        return;
     }
+    // External RAM while disabled
     else if(address >= 0xA000 && address < 0xC000){
-        if(ramEnabled){
-            ramMemory[(address - 0xA000) + (ramBankNumber * 0x2000)] = val;
-        }
         return;
     }
-    // Echo
-    else if(address >= 0xE000 && address <= 0xFDFF){
-        writeByte(address - 0x2000, val);
-    }
     // VRAM Tile Set
     else if(address >= 0x8000 && address <= 0x97FF){
-        memory[address] = val;
+        memory[address - MEMORY_START] = val;
         updateTileSet(address);
         return;
     }
     else if(address >= 0xFE00 && address <= 0xFE9F){
-        memory[address] = val;
+        memory[address - MEMORY_START] = val;
         updateSpriteSet(address, val);
         return;
     }
-    else if(address == 0xFF00){
-        joypad.writeByte(val);
-        return;
-    }
-    else if(address == 0xFF04){
-        timer.divider = 0;
-        return;
-    }
-    else if(address == 0xFF05){
-        timer.counter = val;
-        return;
-    }
-    else if(address == 0xFF06){
-        timer.modulo = val;
-        return;
-    }
-    else if(address == 0xFF07){
-        timer.control = val;
-        timer.setControlRate();
-        return;
-    }
-    else if (address == 0xFF0F){
-        ifRegister = 0x1F & val;
-        return;
-    }
-    else if((address >= 0xFF10 && address <= 0xFF3F) &&
-            !(address >= 0xFF27 && address <= 0xFF2F)){
-        apu.writeByte(address, val);
-        return;
-    }
-    else if(address == 0xFF40){
-        switchBG      = (val & 0x01) ? 1 : 0;
-        switchOBJ     = (val & 0x02) ? 1 : 0;
-        spriteDoubled = (val & 0x04) ? 1 : 0;
-        bgMap         = (val & 0x08) ? 1 : 0;
-        bgTile        = (val & 0x10) ? 1 : 0;
-        switchWindow  = (val & 0x20) ? 1 : 0;
-        windowTile    = (val & 0x40) ? 1 : 0;
-        switchLCD     = (val & 0x80) ? 1 : 0;
-        return;
-    }
-    else if(address == 0xFF41){
-        lcdStatRegister = (val & 0x78) | (memory[address] & 0x07);
-        return;
-    }
-    else if(address == 0xFF42){
-        scrollY = val;
-        return;
-    }
-    else if(address == 0xFF43){
-        scrollX = val;
-        return;
-    }
-    else if(address == 0xFF4A){
-        windowY = val;
+    else if(address >= 0xFEA0 && address <= 0xFEFF){
         return;
     }
-    else if(address == 0xFF4B){
-        windowX = val;
-        return;
-    }
-    else if(address == 0xFF46){
-        dmaTransfer(val);
-    }
-    else if(address == 0xFF47){
-        setPalette(palette, val);
-        return;
-    }
-    else if(address == 0xFF48){
-        setPalette(obj0Palette, val);
-        return;
-    }
-    else if(address == 0xFF49){
-        setPalette(obj1Palette, val);
-        return;
-    }
-    else if(address == 0xFF50){
-        inBIOS = false;
-        return;
+    
+    // I/O page
+    if(isIORegister(address)){
+        gb.cpu.ioAccess();
     }
-    else if(address == 0xFFFF){
-        ieRegister = val;
+    
+    IOWrite write = ioWrites[address & 0xFF];
+    if(write){
+        write(gb, address, val);
         return;
     }
     
-    memory[address] = val;
+    memory[address - MEMORY_START] = val;
 }
 
 WORD MMU::readWord(WORD address){
@@ -319,12 +315,11 @@ void MMU::writeWord(WORD address, WORD val){
 }
 
 // Read Rom
-void MMU::readROM(const std::string& rom){
-    FILE * file = fopen(rom.c_str(), "rb");
-    if (file == NULL) return;
-    fread(cartridgeMemory, 1, MAX_MEMORY, file);
-    fclose(file);
-    memcpy(memory, cartridgeMemory, GAMEBOY_MEMORY*sizeof(BYTE));
+bool MMU::readROM(const std::string& path){
+    rom = ROMImage::open(path);
+    if(!rom){
+        return false;
+    }
+    mapBanks();
+    return true;
 }
-
-MMU mmu;
@@ -8,22 +8,47 @@
 #include "timer.hpp"
 #include "apu.hpp"
 #include "registers.hpp"
+#include "romImage.hpp"
 
 // 384 max tiles allowed in VRAM
 #define MAX_TILES 384
 
 // 2^16 spots
-#define MAX_MEMORY 0x200000
 #define GAMEBOY_MEMORY 65536
 
+// memory[] starts at VRAM, the ROM is in the shared ROMImage
+#define MEMORY_START 0x8000
+
+class GameBoy;
+
+// Handlers for a register in the I/O page, see MMU::mapIO()
+typedef BYTE (*IORead)(GameBoy& gb, WORD address);
+typedef void (*IOWrite)(GameBoy& gb, WORD address, BYTE val);
+
 class MMU{
     
-    BYTE memory[GAMEBOY_MEMORY];
-    BYTE cartridgeMemory[MAX_MEMORY];
-    BYTE ramMemory[0x8000];
+    GameBoy& gb;
+    
+    BYTE memory[GAMEBOY_MEMORY - MEMORY_START];
+    // Shared with every other machine running the same ROM
+    std::shared_ptr<const ROMImage> rom;
+    // 16 banks, the most an MBC5 has
+    BYTE ramMemory[0x20000];
     
     bool inBIOS = true;
     
+    // One entry per 256-byte page, pointing at the page in its backing array. Pages left
+    // as nullptr go through the handlers in readByte/writeByte, see MMU::mapPages().
+    const BYTE* readPages[256];
+    BYTE* writePages[256];
+    
+    // The ROM's predecoded instructions for each ROM page, nullptr while the boot ROM is mapped
+    const DecodedInstruction* decodedPages[0x80];
+    
+    // Registers in the I/O page by the low byte of their address, including IE at 0xFFFF
+    IORead ioReads[256];
+    IOWrite ioWrites[256];
+    
     BYTE bootROM[256] = {
         0x31, 0xFE, 0xFF, 0xAF, 0x21, 0xFF, 0x9F, 0x32, 0xCB, 0x7C, 0x20, 0xFB, 0x21, 0x26, 0xFF, 0x0E,
         0x11, 0x3E, 0x80, 0x32, 0xE2, 0x0C, 0x3E, 0xF3, 0xE2, 0x32, 0x3E, 0x77, 0x77, 0x3E, 0xFC, 0xE0,
@@ -48,40 +73,47 @@ class MMU{
     void setPalette(BYTE palette[4][4], BYTE val);
     void dmaTransfer(const BYTE& val);
     
+    void mapPages();
+    void mapBanks();
+    
 public:
+    explicit MMU(GameBoy& gb) : gb(gb){}
+    
     // Internal tile set of 8x8 pixels
-    BYTE tileSet[MAX_TILES][8][8];
+    BYTE tileSet[MAX_TILES][8][8] = {};
     
     // Internal Sprite Map
-    SPRITE spriteSet[40];
+    SPRITE spriteSet[40] = {};
     
-    bool bgMap;
-    bool bgTile;
-    bool windowTile;
-    bool switchBG;
-    bool switchOBJ;
-    bool switchLCD;
-    bool switchWindow;
-    bool spriteDoubled;
+    bool bgMap = false;
+    bool bgTile = false;
+    bool windowTile = false;
+    bool switchBG = false;
+    bool switchOBJ = false;
+    bool switchLCD = false;
+    bool switchWindow = false;
+    bool spriteDoubled = false;
     
-    BYTE scrollX;
-    BYTE scrollY;
+    BYTE scrollX = 0;
+    BYTE scrollY = 0;
     
-    BYTE windowX;
-    BYTE windowY;
+    BYTE windowX = 0;
+    BYTE windowY = 0;
     
     int line = 0;
+    BYTE lineCompare = 0;
     
     // Given a pixel labelled 0-3, return an array with RGBA values
-    BYTE palette[4][4];
-    BYTE obj0Palette[4][4];
-    BYTE obj1Palette[4][4];
+    BYTE palette[4][4] = {};
+    BYTE obj0Palette[4][4] = {};
+    BYTE obj1Palette[4][4] = {};
     
     BYTE lcdStatRegister = 0;
     
     // Memory Banking
     bool mbc1 = false;
-    BYTE romBankNumber = 0x01;
+    bool mbc5 = false;
+    WORD romBankNumber = 0x01;
     BYTE ramBankNumber = 0x0;
     bool ramEnabled = false;
     bool romMode = true;
@@ -91,15 +123,25 @@ public:
     void updateBanking();
     void handleBanking(WORD address, BYTE val);
     
+    // Predecoded instructions for the page address is in, or nullptr to read them through readByte
+    const DecodedInstruction* decodedPage(WORD address) const { return address < 0x8000 ? decodedPages[address >> 8] : nullptr; }
+    
+#ifdef GB_JIT_ENABLED
+    // Blocks compiled from the ROM, nullptr until one is loaded
+    JIT* jit() const { return rom ? rom->jit() : nullptr; }
+#endif
+    
     BYTE readByte(WORD address);
     void writeByte(WORD address, BYTE val);
     
     WORD readWord(WORD address);
     void writeWord(WORD address, WORD val);
     
-    void readROM(const std::string& rom);
+    // Called by each device's reset() for the registers it handles
+    void mapIO(WORD address, IORead read, IOWrite write);
+    
+    // Logs why through SDL_Log and returns false if the ROM can't be loaded
+    bool readROM(const std::string& path);
 };
 
-extern MMU mmu;
-
 #endif /* mmu_hpp */
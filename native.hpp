@@ -0,0 +1,48 @@
+#ifndef native_hpp
+#define native_hpp
+
+#include <cstdint>
+#include "definitions.hpp"
+#include "alu.hpp"
+#include "registers.hpp"
+
+// What the emulator and code it didn't compile itself agree on: blocks compiled as they're
+// found, see JIT, and ROMs recompiled ahead of time into a library, see Recompiler. A
+// library includes this and nothing else from the emulator, so it doesn't link against it.
+
+// Bumped whenever anything here changes
+#define NATIVE_LIBRARY_VERSION 1
+
+// The NativeLibrary a recompiled ROM exports
+#define NATIVE_LIBRARY_SYMBOL "gbNativeLibrary"
+
+class CPU;
+
+// Runs a block and adds the cycles it ran to *cycles. Returns false if it stopped early
+// because an instruction requested an exit, PC is then just after that instruction.
+typedef bool (*CompiledCode)(CPU& cpu, Registers& regs, int* cycles);
+
+// An instruction's handler, by DecodedInstruction::handler. Returns its cycles.
+typedef int (*CompiledHandler)(CPU& cpu, WORD operand);
+
+struct NativeBlock{
+    uint32_t offset;    // into the ROM
+    WORD start;         // PC of the first instruction
+    WORD end;           // PC after the last instruction
+    WORD last;          // PC of the last instruction
+    int leadCycles;     // every instruction's cycles but the last one's
+    CompiledCode code;
+};
+
+struct NativeLibrary{
+    uint32_t version;
+    char buildID[64];
+    BYTE romHash[20];
+    uint32_t blockCount;
+    const NativeBlock* blocks;
+    
+    // Set by the emulator before any block runs
+    const CompiledHandler* handlers;
+};
+
+#endif /* native_hpp */
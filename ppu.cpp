@@ -1,11 +1,12 @@
 #include "ppu.hpp"
-#include "mmu.hpp"
+#include "gameboy.hpp"
+#include <algorithm>
 
 void PPU::initTileSet(){
     for(int tile = 0; tile < MAX_TILES; tile++){
         for(int y = 0; y < 8; y++){
             for(int x = 0; x < 8; x++){
-                mmu.tileSet[tile][y][x] = 0;
+                gb.mmu.tileSet[tile][y][x] = 0;
             }
         }
     }
@@ -13,10 +14,10 @@ void PPU::initTileSet(){
 
 void PPU::initSpriteSet(){
     for(int i = 0, addr = 0xFE00; i < 40; i++, addr+=4){
-        mmu.writeByte(addr, 0);
-        mmu.writeByte(addr + 1, 0);
-        mmu.writeByte(addr + 2, 0);
-        mmu.writeByte(addr + 3, 0);
+        gb.mmu.writeByte(addr, 0);
+        gb.mmu.writeByte(addr + 1, 0);
+        gb.mmu.writeByte(addr + 2, 0);
+        gb.mmu.writeByte(addr + 3, 0);
     }
 }
 
@@ -47,16 +48,16 @@ void PPU::renderImage(){
 void PPU::renderBackground(BYTE scanRow[160]){
     
     // Determine which map to use
-    WORD mapOffset = mmu.bgMap ? 0x9C00 : 0x9800;
+    WORD mapOffset = gb.mmu.bgMap ? 0x9C00 : 0x9800;
     
     // Determine where to draw on screen (framebuffer)
-    int screenOffset = mmu.line * 160 * 4;
+    int screenOffset = gb.mmu.line * 160 * 4;
     
     for(int column = 0; column < 160; column++){
         
         // Work out the index of the pixel in the framebuffer
-        WORD lineOffset = (mmu.scrollX + column  ) % 256;
-        WORD rowOffset  = (mmu.scrollY + mmu.line) % 256;
+        WORD lineOffset = (gb.mmu.scrollX + column  ) % 256;
+        WORD rowOffset  = (gb.mmu.scrollY + gb.mmu.line) % 256;
         
         // Work out the tile for this pixel
         WORD tileX = lineOffset / 8;
@@ -70,18 +71,18 @@ void PPU::renderBackground(BYTE scanRow[160]){
         int y = rowOffset % 8;
         int x = lineOffset % 8;
         
-        int tile = mmu.readByte(tileIDAddress);
+        int tile = gb.mmu.readByte(tileIDAddress);
         
-        if(!mmu.bgTile && tile < 128){
+        if(!gb.mmu.bgTile && tile < 128){
             tile += 256;
         }
         
         // Map to palette
         BYTE colour[4];
         for(int i = 0; i < 4; i++){
-            colour[i] = mmu.palette[mmu.tileSet[tile][y][x]][i];
+            colour[i] = gb.mmu.palette[gb.mmu.tileSet[tile][y][x]][i];
         }
-        scanRow[column] = mmu.tileSet[tile][y][x];
+        scanRow[column] = gb.mmu.tileSet[tile][y][x];
         frameBuffer[screenOffset] = colour[0];
         frameBuffer[screenOffset + 1] = colour[1];
         frameBuffer[screenOffset + 2] = colour[2];
@@ -92,21 +93,21 @@ void PPU::renderBackground(BYTE scanRow[160]){
 
 void PPU::renderWindow(BYTE scanRow[160]){
     
-    if (mmu.line < mmu.windowY){
+    if (gb.mmu.line < gb.mmu.windowY){
         return;
     }
     
     // Determine which map to use
-    WORD mapOffset = mmu.windowTile ? 0x9C00 : 0x9800;
+    WORD mapOffset = gb.mmu.windowTile ? 0x9C00 : 0x9800;
     
     // Determine where to draw on screen (framebuffer)
-    int screenOffset = mmu.line * 160 * 4;
+    int screenOffset = gb.mmu.line * 160 * 4;
     
     for(int column = 0; column < 160; column++){
         
         // Work out the index of the pixel in the framebuffer
-        WORD lineOffset = mmu.windowX + column - 7;
-        WORD rowOffset = mmu.line - mmu.windowY;
+        WORD lineOffset = gb.mmu.windowX + column - 7;
+        WORD rowOffset = gb.mmu.line - gb.mmu.windowY;
         
         // Work out the tile for this pixel
         WORD tileX = lineOffset / 8;
@@ -120,9 +121,9 @@ void PPU::renderWindow(BYTE scanRow[160]){
         int x = lineOffset % 8;
         int y = rowOffset % 8;
         
-        int tile = mmu.readByte(tileIDAddress);
+        int tile = gb.mmu.readByte(tileIDAddress);
         
-        if(!mmu.bgTile && tile < 128){
+        if(!gb.mmu.bgTile && tile < 128){
             tile += 256;
         }
         
@@ -130,9 +131,9 @@ void PPU::renderWindow(BYTE scanRow[160]){
         BYTE colour[4];
         
         for(int i = 0; i < 4; i++){
-            colour[i] = mmu.palette[mmu.tileSet[tile][y][x]][i];
+            colour[i] = gb.mmu.palette[gb.mmu.tileSet[tile][y][x]][i];
         }
-        scanRow[column] = mmu.tileSet[tile][y][x];
+        scanRow[column] = gb.mmu.tileSet[tile][y][x];
         frameBuffer[screenOffset] = colour[0];
         frameBuffer[screenOffset + 1] = colour[1];
         frameBuffer[screenOffset + 2] = colour[2];
@@ -144,18 +145,18 @@ void PPU::renderWindow(BYTE scanRow[160]){
 void PPU::renderSprites(BYTE scanRow[160]){
     for(int i = 0; i < 40; i++){
         
-        SPRITE& sprite = mmu.spriteSet[i];
+        SPRITE& sprite = gb.mmu.spriteSet[i];
         
-        int height = mmu.spriteDoubled ? 16 : 8;
-        if(sprite.posY <= mmu.line && (sprite.posY + height) > mmu.line){
-            int screenOffset = (mmu.line * 160 + sprite.posX) * 4;
+        int height = gb.mmu.spriteDoubled ? 16 : 8;
+        if(sprite.posY <= gb.mmu.line && (sprite.posY + height) > gb.mmu.line){
+            int screenOffset = (gb.mmu.line * 160 + sprite.posX) * 4;
             
             BYTE tileRow[8];
             for(int j = 0; j < 8; j++){
-                tileRow[j] = mmu.tileSet[sprite.tileNumber]
+                tileRow[j] = gb.mmu.tileSet[sprite.tileNumber]
                 [sprite.flippedY ?
-                 ((height - 1) - (mmu.line - sprite.posY)) :
-                 (mmu.line - sprite.posY)
+                 ((height - 1) - (gb.mmu.line - sprite.posY)) :
+                 (gb.mmu.line - sprite.posY)
                  ]
                 [j];
             }
@@ -163,7 +164,7 @@ void PPU::renderSprites(BYTE scanRow[160]){
             BYTE palette[4][4];
             for(int j = 0; j < 4; j++){
                 for(int k = 0; k < 4; k++){
-                    palette[j][k] = sprite.zeroPalette ? mmu.obj0Palette[j][k] : mmu.obj1Palette[j][k];
+                    palette[j][k] = sprite.zeroPalette ? gb.mmu.obj0Palette[j][k] : gb.mmu.obj1Palette[j][k];
                 }
             }
             
@@ -188,20 +189,20 @@ void PPU::renderSprites(BYTE scanRow[160]){
 
 void PPU::renderScan(){
     
-    if(!mmu.switchLCD){
+    if(!gb.mmu.switchLCD){
         return;
     }
     
     BYTE scanRow[160];
-    if(mmu.switchBG){
+    if(gb.mmu.switchBG){
         renderBackground(scanRow);
     }
     
-    if(mmu.switchWindow){
+    if(gb.mmu.switchWindow){
         renderWindow(scanRow);
     }
     
-    if(mmu.switchOBJ){
+    if(gb.mmu.switchOBJ){
         renderSprites(scanRow);
     }
     
@@ -209,17 +210,18 @@ void PPU::renderScan(){
 
 void PPU::setLCDStatus(){
     
-    BYTE currentMode = mmu.lcdStatRegister & 0x3;
+    int clock = (int) (gb.scheduler.now - modeStart);
+    BYTE currentMode = gb.mmu.lcdStatRegister & 0x3;
     
     BYTE lcdMode = 0;
     bool shouldInterrupt = false;
     
     // V-Blank
-    if(mmu.line >= 144){
+    if(gb.mmu.line >= 144){
         lcdMode = 1;
-        mmu.lcdStatRegister &= 0xFC;
-        mmu.lcdStatRegister |= 0x01;
-        shouldInterrupt = mmu.lcdStatRegister & 0x10;
+        gb.mmu.lcdStatRegister &= 0xFC;
+        gb.mmu.lcdStatRegister |= 0x01;
+        shouldInterrupt = gb.mmu.lcdStatRegister & 0x10;
     }
     else{
         
@@ -229,35 +231,35 @@ void PPU::setLCDStatus(){
         
         if(clock >= mode2Bounds){
             lcdMode = 2;
-            mmu.lcdStatRegister &= 0xFC;
-            mmu.lcdStatRegister |= 0x01;
-            shouldInterrupt = mmu.lcdStatRegister & 0x20;
+            gb.mmu.lcdStatRegister &= 0xFC;
+            gb.mmu.lcdStatRegister |= 0x01;
+            shouldInterrupt = gb.mmu.lcdStatRegister & 0x20;
         }
         else if(clock >= mode3Bounds){
             lcdMode = 3;
-            mmu.lcdStatRegister |= 0x03;
+            gb.mmu.lcdStatRegister |= 0x03;
         }
         else{
             lcdMode = 0;
-            mmu.lcdStatRegister &= 0xFC;
-            shouldInterrupt = mmu.lcdStatRegister & 0x08;
+            gb.mmu.lcdStatRegister &= 0xFC;
+            shouldInterrupt = gb.mmu.lcdStatRegister & 0x08;
         }
         
     }
     
     if(shouldInterrupt && (lcdMode != currentMode)){
-        ifRegister |= 0x2;
+        gb.cpu.requestInterrupt(INTERRUPT_STAT);
     }
     
     // LY = LYC
-    if(mmu.line == mmu.readByte(0xFF45)){
-        mmu.lcdStatRegister |= 0x4;
-        if(mmu.lcdStatRegister & 0x40){
-            ifRegister |= 0x2;
+    if(gb.mmu.line == gb.mmu.lineCompare){
+        gb.mmu.lcdStatRegister |= 0x4;
+        if(gb.mmu.lcdStatRegister & 0x40){
+            gb.cpu.requestInterrupt(INTERRUPT_STAT);
         }
     }
     else{
-        mmu.lcdStatRegister &= 0xFB;
+        gb.mmu.lcdStatRegister &= 0xFB;
     }
     
 }
@@ -265,20 +267,71 @@ void PPU::setLCDStatus(){
 void PPU::reset(){
     initTileSet();
     initSpriteSet();
-    initVideo();
+    if(!gb.headless){
+        initVideo();
+    }
+    modeStart = gb.scheduler.now;
+    requestStep();
+    mapIO();
+}
+
+// LCD registers, kept in the MMU where the renderer reads them
+void PPU::mapIO(){
+    gb.mmu.mapIO(0xFF40, [](GameBoy& gb, WORD){
+        return (BYTE) ((gb.mmu.switchBG      ? 0x01 : 0x00) |
+                       (gb.mmu.switchOBJ     ? 0x02 : 0x00) |
+                       (gb.mmu.spriteDoubled ? 0x04 : 0x00) |
+                       (gb.mmu.bgMap         ? 0x08 : 0x00) |
+                       (gb.mmu.bgTile        ? 0x10 : 0x00) |
+                       (gb.mmu.switchWindow  ? 0x20 : 0x00) |
+                       (gb.mmu.windowTile    ? 0x40 : 0x00) |
+                       (gb.mmu.switchLCD     ? 0x80 : 0x00));
+    }, [](GameBoy& gb, WORD, BYTE val){
+        gb.mmu.switchBG      = (val & 0x01) ? 1 : 0;
+        gb.mmu.switchOBJ     = (val & 0x02) ? 1 : 0;
+        gb.mmu.spriteDoubled = (val & 0x04) ? 1 : 0;
+        gb.mmu.bgMap         = (val & 0x08) ? 1 : 0;
+        gb.mmu.bgTile        = (val & 0x10) ? 1 : 0;
+        gb.mmu.switchWindow  = (val & 0x20) ? 1 : 0;
+        gb.mmu.windowTile    = (val & 0x40) ? 1 : 0;
+        gb.mmu.switchLCD     = (val & 0x80) ? 1 : 0;
+    });
+    
+    // The mode and LY = LYC bits are read only
+    gb.mmu.mapIO(0xFF41, [](GameBoy& gb, WORD){ return gb.mmu.lcdStatRegister; }, [](GameBoy& gb, WORD, BYTE val){
+        gb.mmu.lcdStatRegister = (val & 0x78) | (gb.mmu.lcdStatRegister & 0x07);
+        gb.ppu.requestStep();
+    });
+    
+    gb.mmu.mapIO(0xFF42, [](GameBoy& gb, WORD){ return gb.mmu.scrollY; }, [](GameBoy& gb, WORD, BYTE val){ gb.mmu.scrollY = val; });
+    gb.mmu.mapIO(0xFF43, [](GameBoy& gb, WORD){ return gb.mmu.scrollX; }, [](GameBoy& gb, WORD, BYTE val){ gb.mmu.scrollX = val; });
+    gb.mmu.mapIO(0xFF44, [](GameBoy& gb, WORD){ return (BYTE) gb.mmu.line; }, nullptr);
+    gb.mmu.mapIO(0xFF45, [](GameBoy& gb, WORD){ return gb.mmu.lineCompare; }, [](GameBoy& gb, WORD, BYTE val){
+        gb.mmu.lineCompare = val;
+        gb.ppu.requestStep();
+    });
+    gb.mmu.mapIO(0xFF4A, [](GameBoy& gb, WORD){ return gb.mmu.windowY; }, [](GameBoy& gb, WORD, BYTE val){ gb.mmu.windowY = val; });
+    gb.mmu.mapIO(0xFF4B, [](GameBoy& gb, WORD){ return gb.mmu.windowX; }, [](GameBoy& gb, WORD, BYTE val){ gb.mmu.windowX = val; });
 }
 
 void PPU::step(){
     
+    int prevMode = mode;
+    int prevLine = gb.mmu.line;
+    BYTE prevStatus = gb.mmu.lcdStatRegister;
+    WORD prevInterrupts = gb.cpu.regs.ifRegister;
+    
     setLCDStatus();
     
+    int clock = (int) (gb.scheduler.now - modeStart);
+    
     // Screen cycles through (OAM -> VRAM -> HBLANK) * 144 -> VBLANK
     switch (mode){
             // OAM
         case 2:
             
             if (clock >= 320){
-                clock %= 320;
+                modeStart += 320;
                 mode = 3;
             }
             break;
@@ -286,7 +339,7 @@ void PPU::step(){
             // VRAM
         case 3:
             if(clock >= 688){
-                clock %= 688;
+                modeStart += 688;
                 mode = 0;
             }
             break;
@@ -298,14 +351,14 @@ void PPU::step(){
                 
                 renderScan();
                 
-                clock %= 816;
-                mmu.line++;
+                modeStart += 816;
+                gb.mmu.line++;
                 
-                //std::cout << "Line: " << std::dec << mmu.line << std::endl;
+                //std::cout << "Line: " << std::dec << gb.mmu.line << std::endl;
                 
-                if(mmu.line == 144){
+                if(gb.mmu.line == 144){
                     mode = 1;
-                    ifRegister |= 0x1;
+                    gb.cpu.requestInterrupt(INTERRUPT_VBLANK);
                 }
                 else{
                     mode = 2;
@@ -316,27 +369,68 @@ void PPU::step(){
             // VBLANK
         case 1:
             if(clock >= 1824){
-                clock %= 1824;
-                mmu.line++;
+                modeStart += 1824;
+                gb.mmu.line++;
                 
-                if(mmu.line == 154){
-                    renderImage();
+                if(gb.mmu.line == 154){
+                    if(!gb.headless){
+                        renderImage();
+                    }
                     mode = 2;
-                    mmu.line = 0;
+                    gb.mmu.line = 0;
                 }
             }
             break;
     }
+    
+    settled = mode == prevMode && gb.mmu.line == prevLine &&
+              gb.mmu.lcdStatRegister == prevStatus && gb.cpu.regs.ifRegister == prevInterrupts;
+    scheduleStep();
 }
 
 void PPU::quit(){
+    if(gb.headless){
+        return;
+    }
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
 }
 
-void PPU::addToClock(int clockCycles){
-    clock += clockCycles;
+void PPU::requestStep(){
+    gb.scheduler.schedule(EVENT_PPU, gb.scheduler.now + 1);
 }
 
-PPU ppu;
+// Schedules the next step that can do anything. Until then every step would leave the
+// mode, line, STAT and IF as they are. The LY = LYC interrupt is requested again on every
+// step while it's enabled, which only shows once IF is cleared, so clearing IF requests a step.
+void PPU::scheduleStep(){
+    
+    int clock = (int) (gb.scheduler.now - modeStart);
+    
+    // The step after a change sees it in setLCDStatus
+    if(!settled){
+        requestStep();
+        return;
+    }
+    
+    int next = 0;
+    switch(mode){
+        case 2: next = 320 - clock; break;
+        case 3: next = 688 - clock; break;
+        case 0: next = 816 - clock; break;
+        case 1: next = 1824 - clock; break;
+    }
+    
+    // Mode bounds in setLCDStatus
+    if(gb.mmu.line < 144){
+        if(clock < 816){
+            next = std::min(next, 816 - clock);
+        }
+        if(clock < 1504){
+            next = std::min(next, 1504 - clock);
+        }
+    }
+    
+    gb.scheduler.schedule(EVENT_PPU, gb.scheduler.now + std::max(next, 1));
+}
@@ -2,21 +2,31 @@
 #define ppu_hpp
 
 #include <SDL2/SDL.h>
+#include <cstdint>
 #include "definitions.hpp"
 
 // 160 * 144 * 4 == width * height * rgba
 #define FRAME_BUFFER_LENGTH 92160
 
+class GameBoy;
+
 class PPU{
     
+    GameBoy& gb;
+    
     int mode = 2;
-    int clock = 0;
     
-    SDL_Window *window;
-    SDL_Renderer *renderer;
+    // Master clock when the current mode started
+    uint64_t modeStart = 0;
+    
+    // Whether the last step left everything as it was, see PPU::scheduleStep()
+    bool settled = false;
+    
+    SDL_Window *window = nullptr;
+    SDL_Renderer *renderer = nullptr;
     
     // width * height * (r, g, b, a) where each of {r, g, b, a} is a byte value
-    BYTE frameBuffer[FRAME_BUFFER_LENGTH];
+    BYTE frameBuffer[FRAME_BUFFER_LENGTH] = {};
     
     void initTileSet();
     void initSpriteSet();
@@ -29,15 +39,22 @@ class PPU{
     void renderScan();
     
     void setLCDStatus();
+    void scheduleStep();
+    void mapIO();
     
 public:
     
+    explicit PPU(GameBoy& gb) : gb(gb){}
+    
     void reset();
     void step();
     void quit();    
-    void addToClock(int clockCycles);
+    
+    // The last frame drawn, FRAME_BUFFER_LENGTH bytes of RGBA
+    const BYTE* screen() const { return frameBuffer; }
+    
+    // Steps the PPU once the current instruction is done, after a STAT, LYC or IF write
+    void requestStep();
 };
 
-extern PPU ppu;
-
 #endif /* ppu_hpp */
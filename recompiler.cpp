@@ -0,0 +1,241 @@
+#include "recompiler.hpp"
+#include "alu.hpp"
+#include "controlFlow.hpp"
+#include "disassembler.hpp"
+#include "jit.hpp"
+#include <SDL2/SDL.h>
+#include <cerrno>
+#include <cstring>
+
+// Registers in opcode encoding order, see registerIndex()
+static const char* reg8Names[8] = {"regs.BC.hi", "regs.BC.lo", "regs.DE.hi", "regs.DE.lo", "regs.HL.hi", "regs.HL.lo", nullptr, "regs.AF.hi"};
+static const char* reg16Names[4] = {"regs.BC.reg", "regs.DE.reg", "regs.HL.reg", "regs.SP.reg"};
+
+// PC a block at a ROM offset runs from, bank 0 at the bottom and any other in the switchable area
+static WORD startAddress(uint32_t offset){
+    return offset < ROM_BANK_SIZE ? (WORD) offset : (WORD) (0x4000 + offset % ROM_BANK_SIZE);
+}
+
+// Every basic block start, by ROM offset. A basic block longer than JIT_BLOCK_LENGTH gets
+// another start where a block from the last one stops.
+std::vector<uint32_t> Recompiler::findBlocks() const{
+    const ControlFlow& flow = rom.controlFlow();
+    std::vector<uint32_t> starts;
+    for(int number = 0; number < rom.bankCount(); number++){
+        for(const BasicBlock& block : flow.bank(number).blocks){
+            uint32_t offset = (uint32_t) number * ROM_BANK_SIZE + block.start;
+            uint32_t end = offset + block.length;
+            while(true){
+                starts.push_back(offset);
+                BlockExtent extent = measureBlock(rom.decodedBank(0) + offset, offset % ROM_BANK_SIZE);
+                offset += extent.length;
+                if(extent.ended || extent.count < JIT_BLOCK_LENGTH || offset >= end){
+                    break;
+                }
+            }
+        }
+    }
+    return starts;
+}
+
+// What emitInline() in jit.cpp writes out for the instructions classifyInline() picks,
+// with the same effect on the lazy flags. Returns false, having written nothing, for the rest.
+static bool writeInline(FILE* out, const DecodedInstruction& instruction){
+    InlineOp op = classifyInline(instruction);
+    switch(op.kind){
+        case INLINE_NONE:
+            return false;
+            
+        case INLINE_NOP:
+            return true;
+            
+        case INLINE_LD_R_R:
+            fprintf(out, "    %s = %s;\n", reg8Names[op.target], reg8Names[op.source]);
+            return true;
+            
+        case INLINE_LD_R_N8:
+            fprintf(out, "    %s = 0x%02X;\n", reg8Names[op.target], instruction.operand & 0xFF);
+            return true;
+            
+        case INLINE_LD_RR_N16:
+            fprintf(out, "    %s = 0x%04X;\n", reg16Names[op.target], instruction.operand);
+            return true;
+            
+        case INLINE_INC_RR:
+        case INLINE_DEC_RR:
+            fprintf(out, "    %s%s;\n", reg16Names[op.target], op.kind == INLINE_INC_RR ? "++" : "--");
+            return true;
+            
+        // Keep the carry, which may still be pending
+        case INLINE_INC_R:
+        case INLINE_DEC_R:{
+            const char* sign = op.kind == INLINE_INC_R ? "+" : "-";
+            fprintf(out, "    {\n");
+            fprintf(out, "        BYTE left = %s;\n", reg8Names[op.target]);
+            fprintf(out, "        %s = left %s 1;\n", reg8Names[op.target], sign);
+            fprintf(out, "        regs.flagCarry = regs.flagOp == FLAGS_NONE ? (regs.AF.lo & FLAG_C) != 0 : regs.flagCarry;\n");
+            fprintf(out, "        regs.flagOp = %s;\n", op.kind == INLINE_INC_R ? "FLAGS_ADD" : "FLAGS_SUB");
+            fprintf(out, "        regs.flagLeft = left;\n");
+            fprintf(out, "        regs.flagRight = 1;\n");
+            fprintf(out, "        regs.flagResult = left %s 1;\n", sign);
+            fprintf(out, "    }\n");
+            return true;
+        }
+            
+        default:
+            break;
+    }
+    
+    // ADD, SUB, AND, XOR, OR and CP, A with a register or an immediate
+    char right[16];
+    if(op.source < 0){
+        snprintf(right, sizeof(right), "0x%02X", instruction.operand & 0xFF);
+    }
+    else{
+        snprintf(right, sizeof(right), "%s", reg8Names[op.source]);
+    }
+    
+    fprintf(out, "    {\n");
+    fprintf(out, "        int left = regs.AF.hi;\n");
+    fprintf(out, "        int right = %s;\n", right);
+    if(op.kind == INLINE_ADD){
+        fprintf(out, "        int result = left + right;\n");
+        fprintf(out, "        regs.AF.hi = result;\n");
+        fprintf(out, "        regs.flagCarry = result > 0xFF;\n");
+        fprintf(out, "        regs.flagOp = FLAGS_ADD;\n");
+        fprintf(out, "        regs.flagLeft = left;\n");
+        fprintf(out, "        regs.flagRight = right;\n");
+    }
+    else if(op.kind == INLINE_SUB || op.kind == INLINE_CP){
+        fprintf(out, "        int result = left - right;\n");
+        if(op.kind == INLINE_SUB){
+            fprintf(out, "        regs.AF.hi = result;\n");
+        }
+        fprintf(out, "        regs.flagCarry = left < right;\n");
+        fprintf(out, "        regs.flagOp = FLAGS_SUB;\n");
+        fprintf(out, "        regs.flagLeft = left;\n");
+        fprintf(out, "        regs.flagRight = right;\n");
+    }
+    else{
+        fprintf(out, "        int result = left %s right;\n", op.kind == INLINE_AND ? "&" : op.kind == INLINE_XOR ? "^" : "|");
+        fprintf(out, "        regs.AF.hi = result;\n");
+        fprintf(out, "        regs.flagCarry = false;\n");
+        fprintf(out, "        regs.flagOp = %s;\n", op.kind == INLINE_AND ? "FLAGS_AND" : "FLAGS_OR");
+        fprintf(out, "        regs.flagLeft = 0;\n");
+        fprintf(out, "        regs.flagRight = 0;\n");
+    }
+    fprintf(out, "        regs.flagResult = result;\n");
+    fprintf(out, "    }\n");
+    return true;
+}
+
+// Does what the code JIT::emit() compiles does, in C++
+void Recompiler::writeBlock(FILE* out, uint32_t offset){
+    const DecodedInstruction* instructions = rom.decodedBank(0) + offset;
+    BlockExtent extent = measureBlock(instructions, offset % ROM_BANK_SIZE);
+    WORD start = startAddress(offset);
+    
+    fprintf(out, "\n// Bank %u, $%04X\n", offset / ROM_BANK_SIZE, start);
+    fprintf(out, "static bool block%06X(CPU& cpu, Registers& regs, int* cycles){\n", offset);
+    
+    int inlineCycles = 0;
+    bool called = false;
+    int at = 0;
+    for(int i = 0; i < extent.count; i++){
+        const DecodedInstruction& instruction = instructions[at];
+        const OpcodeInfo& info = instructionInfo(instruction);
+        WORD address = start + at;
+        at += instruction.length;
+        WORD next = start + at;
+        
+        fprintf(out, "    // %s\n", disassemble(instruction, address).c_str());
+        if(writeInline(out, instruction)){
+            inlineCycles += info.cycles;
+            called = false;
+            continue;
+        }
+        
+        if(inlineCycles){
+            fprintf(out, "    *cycles += %d;\n    regs.pendingCycles += %d;\n", inlineCycles, inlineCycles);
+            inlineCycles = 0;
+        }
+        fprintf(out, "    regs.PC = 0x%04X;\n", next);
+        fprintf(out, "    {\n");
+        fprintf(out, "        int clockCycles = gbNativeLibrary.handlers[0x%03X](cpu, 0x%04X);\n", instruction.handler, instruction.operand);
+        fprintf(out, "        *cycles += clockCycles;\n");
+        fprintf(out, "        regs.pendingCycles += clockCycles;\n");
+        fprintf(out, "    }\n");
+        called = true;
+        
+        if(i < extent.count - 1 && info.memory != MEMORY_NONE){
+            fprintf(out, "    if(regs.exitRequested){\n        return false;\n    }\n");
+        }
+    }
+    
+    if(inlineCycles){
+        fprintf(out, "    *cycles += %d;\n    regs.pendingCycles += %d;\n", inlineCycles, inlineCycles);
+    }
+    if(!called){
+        fprintf(out, "    regs.PC = 0x%04X;\n", (WORD) (start + extent.length));
+    }
+    fprintf(out, "    return true;\n}\n");
+}
+
+bool Recompiler::write(const std::string& path, const std::string& romName){
+    std::vector<uint32_t> starts = findBlocks();
+    
+    // Single instructions aren't worth it, as with the JIT
+    std::vector<uint32_t> blocks;
+    for(uint32_t offset : starts){
+        if(measureBlock(rom.decodedBank(0) + offset, offset % ROM_BANK_SIZE).count >= JIT_BLOCK_MIN_LENGTH){
+            blocks.push_back(offset);
+        }
+    }
+    
+    FILE* out = fopen(path.c_str(), "w");
+    if(!out){
+        SDL_Log("Could not write %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    
+    fprintf(out, "// %s recompiled by the emulator's --recompile, see Recompiler. Built with:\n", romName.c_str());
+    fprintf(out, "//     c++ -std=c++17 -O2 -shared -fPIC -I<emulator source> <this file> -o <library>\n");
+    fprintf(out, "// and only loaded by the build of the emulator that wrote it.\n\n");
+    fprintf(out, "#include \"native.hpp\"\n\n");
+    fprintf(out, "extern \"C\" __attribute__((visibility(\"default\"))) NativeLibrary gbNativeLibrary;\n");
+    
+    for(uint32_t offset : blocks){
+        writeBlock(out, offset);
+    }
+    
+    if(!blocks.empty()){
+        fprintf(out, "\nstatic const NativeBlock blocks[] = {\n");
+        for(uint32_t offset : blocks){
+            BlockExtent extent = measureBlock(rom.decodedBank(0) + offset, offset % ROM_BANK_SIZE);
+            WORD start = startAddress(offset);
+            fprintf(out, "    {0x%06X, 0x%04X, 0x%04X, 0x%04X, %d, block%06X},\n", offset, start,
+                    (WORD) (start + extent.length), (WORD) (start + extent.lastOffset), extent.leadCycles, offset);
+        }
+        fprintf(out, "};\n");
+    }
+    
+    fprintf(out, "\nNativeLibrary gbNativeLibrary = {\n");
+    fprintf(out, "    NATIVE_LIBRARY_VERSION,\n    \"");
+    for(const char* c = buildID(); *c; c++){
+        fprintf(out, *c == '"' || *c == '\\' ? "\\%c" : "%c", *c);
+    }
+    fprintf(out, "\",\n    {");
+    for(int i = 0; i < 20; i++){
+        fprintf(out, i ? ", 0x%02X" : "0x%02X", rom.sha1()[i]);
+    }
+    fprintf(out, "},\n    %zu,\n    %s,\n    nullptr\n};\n", blocks.size(), blocks.empty() ? "nullptr" : "blocks");
+    
+    if(fclose(out) != 0){
+        SDL_Log("Could not write %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    
+    SDL_Log("Recompiled %zu blocks of %s into %s, %d jumps left to the interpreter", blocks.size(), romName.c_str(),
+            path.c_str(), rom.controlFlow().unresolved());
+    return true;
+}
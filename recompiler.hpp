@@ -0,0 +1,34 @@
+#ifndef recompiler_hpp
+#define recompiler_hpp
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "definitions.hpp"
+#include "isa.hpp"
+#include "romImage.hpp"
+
+// Writes the code ControlFlow found in a ROM out as C++, a function per block, to be built
+// into a library the JIT runs in place of compiling the blocks itself, see JIT::load().
+//
+// A block starts at every basic block start, and runs as far as a block the JIT compiles
+// would. Blocks are found at run time by the ROM offset they're mapped from, so one in a
+// bank the walk guessed wrong only costs code size. Jumps through HL not from a table, and
+// code the walk never reached, are left to the interpreter.
+class Recompiler{
+    
+    const ROMImage& rom;
+    
+    std::vector<uint32_t> findBlocks() const;
+    void writeBlock(FILE* out, uint32_t offset);
+    
+public:
+    
+    explicit Recompiler(const ROMImage& rom) : rom(rom){}
+    
+    // Logs how many blocks were written, or why the file couldn't be, through SDL_Log
+    bool write(const std::string& path, const std::string& romName);
+};
+
+#endif /* recompiler_hpp */
@@ -1,10 +0,0 @@
-#include "registers.hpp"
-
-Register AF;
-Register BC;
-Register DE;
-Register HL;
-Register SP;
-WORD PC;
-WORD ifRegister;
-WORD ieRegister;
@@ -11,13 +11,56 @@ union Register{
     };
 };
 
-extern Register AF;
-extern Register BC;
-extern Register DE;
-extern Register HL;
-extern Register SP;
-extern WORD PC;
-extern WORD ifRegister;
-extern WORD ieRegister;
+// Index into Registers::r8 of an 8-bit register in opcode encoding order B, C, D, E, H, L, (HL), A.
+// There's no register for (HL), F takes its slot.
+constexpr int registerIndex(int r){
+    return r < 6 ? r ^ 1 : r;
+}
+
+// Everything the CPU touches on every instruction, in one cache line, so the interpreter
+// doesn't pull in anything else between memory accesses. Also the CPU's part of a save state.
+struct alignas(64) Registers{
+    
+    // The pairs in PUSH/POP encoding order, little-endian like Register
+    union{
+        struct{
+            Register BC;
+            Register DE;
+            Register HL;
+            Register AF;
+        };
+        BYTE r8[8];
+        WORD r16[4];
+    };
+    Register SP;
+    WORD PC;
+    WORD ifRegister;
+    WORD ieRegister;
+    
+    // IF & IE, kept up to date by everything that writes either, see CPU::updateInterrupts()
+    BYTE pendingInterrupts;
+    bool halt;
+    bool IME;
+    
+    // Lazy flags, see CPU::materialiseFlags()
+    BYTE flagOp;
+    BYTE flagLeft;
+    BYTE flagRight;
+    BYTE flagResult;
+    bool flagCarry;
+    
+    // Batch execution, see CPU::runUntil(). pendingCycles is 0 between batches.
+    int pendingCycles;
+    bool exitRequested;
+};
+
+static_assert(sizeof(Registers) == 64, "Registers should fill exactly one cache line");
+
+// Interrupt bits in IF and IE, highest priority first
+#define INTERRUPT_VBLANK 0x01
+#define INTERRUPT_STAT 0x02
+#define INTERRUPT_TIMER 0x04
+#define INTERRUPT_SERIAL 0x08
+#define INTERRUPT_JOYPAD 0x10
 
 #endif /* registers_hpp */
@@ -0,0 +1,341 @@
+#include "romImage.hpp"
+#include "controlFlow.hpp"
+#include "jit.hpp"
+#include "translationCache.hpp"
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <future>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// Every image loaded in the process by content hash, dropped with the last machine using it,
+// and the one being prepared if there is one, for others loading the same ROM to wait on
+struct CacheEntry{
+    std::weak_ptr<const ROMImage> image;
+    std::shared_future<std::shared_ptr<const ROMImage>> preparing;
+};
+static std::mutex cacheMutex;
+static std::unordered_map<uint64_t, CacheEntry> cache;
+
+static uint64_t fnv1a(const BYTE* bytes, size_t length){
+    uint64_t hash = 0xCBF29CE484222325;
+    for(size_t i = 0; i < length; i++){
+        hash = (hash ^ bytes[i]) * 0x100000001B3;
+    }
+    return hash;
+}
+
+static uint32_t rotate(uint32_t x, int n){
+    return (x << n) | (x >> (32 - n));
+}
+
+// Taken of the file alone, so it's the same as any other tool would give
+static void sha1Digest(const BYTE* bytes, size_t length, BYTE digest[20]){
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    
+    // The message, a 1 bit, zeroes up to 8 bytes short of a whole block, then its bit length
+    size_t padded = (length + 8) / 64 * 64 + 64;
+    for(size_t block = 0; block < padded; block += 64){
+        BYTE chunk[64];
+        for(int i = 0; i < 64; i++){
+            size_t at = block + i;
+            chunk[i] = at < length ? bytes[at] : at == length ? 0x80 : 0;
+        }
+        if(block + 64 == padded){
+            for(int i = 0; i < 8; i++){
+                chunk[56 + i] = (BYTE) ((uint64_t) length * 8 >> (56 - i * 8));
+            }
+        }
+        
+        uint32_t w[80];
+        for(int i = 0; i < 16; i++){
+            w[i] = (uint32_t) chunk[i * 4] << 24 | chunk[i * 4 + 1] << 16 | chunk[i * 4 + 2] << 8 | chunk[i * 4 + 3];
+        }
+        for(int i = 16; i < 80; i++){
+            w[i] = rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for(int i = 0; i < 80; i++){
+            uint32_t f, k;
+            if(i < 20){
+                f = (b & c) | (~b & d); k = 0x5A827999;
+            }
+            else if(i < 40){
+                f = b ^ c ^ d; k = 0x6ED9EBA1;
+            }
+            else if(i < 60){
+                f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC;
+            }
+            else{
+                f = b ^ c ^ d; k = 0xCA62C1D6;
+            }
+            uint32_t t = rotate(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = rotate(b, 30); b = a; a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+    
+    for(int i = 0; i < 20; i++){
+        digest[i] = (BYTE) (h[i / 4] >> (24 - (i % 4) * 8));
+    }
+}
+
+std::shared_ptr<const ROMImage> ROMImage::open(const std::string& path){
+    std::shared_ptr<ROMImage> image(new ROMImage());
+    if(!image->load(path)){
+        return nullptr;
+    }
+    
+    auto sameROM = [&](const std::shared_ptr<const ROMImage>& other){
+        return other && other->size == image->size && memcmp(other->data, image->data, image->size) == 0;
+    };
+    
+    // Machines loading the same ROM at once wait for one of them to predecode it, or read
+    // back the last run's, without holding up loads of any other ROM
+    std::promise<std::shared_ptr<const ROMImage>> prepared;
+    std::shared_future<std::shared_ptr<const ROMImage>> preparing;
+    bool preparer;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        CacheEntry& entry = cache[image->contentHash];
+        std::shared_ptr<const ROMImage> cached = entry.image.lock();
+        if(sameROM(cached)){
+            return cached;
+        }
+        preparer = !entry.preparing.valid();
+        if(preparer){
+            entry.preparing = prepared.get_future().share();
+        }
+        preparing = entry.preparing;
+    }
+    
+    // On a hash collision it's prepared again, and if preparing it failed this one tries
+    if(!preparer){
+        try{
+            std::shared_ptr<const ROMImage> other = preparing.get();
+            if(sameROM(other)){
+                return other;
+            }
+        }
+        catch(...){
+        }
+    }
+    
+    // Out of memory or threads, the entry's left free so the next load can try again
+    try{
+        sha1Digest(image->data, image->fileSize, image->contentSHA1);
+        image->translations.reset(new TranslationCache(image->contentSHA1, image->size));
+        if(image->translations->open()){
+            image->decoded = image->translations->instructions();
+        }
+        else{
+            image->predecode();
+        }
+        image->flow.reset(new ControlFlow(*image));
+#ifdef GB_JIT_ENABLED
+        image->compiled.reset(new JIT(*image));
+        for(int i = 0; i < image->translations->hotBlockCount(); i++){
+            const CachedBlock& block = image->translations->hotBlocks()[i];
+            if(block.offset < image->size){
+                image->compiled->compile(image->decoded + block.offset, block.start);
+            }
+        }
+#endif
+    }
+    catch(...){
+        if(preparer){
+            {
+                std::lock_guard<std::mutex> lock(cacheMutex);
+                cache[image->contentHash].preparing = {};
+            }
+            prepared.set_exception(std::current_exception());
+        }
+        throw;
+    }
+    
+    // Replaces an image that's gone, or on a hash collision the newest one wins
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        CacheEntry& entry = cache[image->contentHash];
+        entry.image = image;
+        if(preparer){
+            entry.preparing = {};
+        }
+    }
+    if(preparer){
+        prepared.set_value(image);
+    }
+    return image;
+}
+
+ROMImage::~ROMImage(){
+    saveTranslations();
+    unload();
+}
+
+bool ROMImage::load(const std::string& path){
+    unload();
+    
+    int file = ::open(path.c_str(), O_RDONLY);
+    if(file < 0){
+        SDL_Log("Could not open ROM %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    
+    struct stat fileInfo;
+    if(fstat(file, &fileInfo) < 0){
+        SDL_Log("Could not read ROM %s: %s", path.c_str(), strerror(errno));
+        close(file);
+        return false;
+    }
+    
+    fileSize = fileInfo.st_size;
+    if(fileSize == 0 || fileSize > MAX_ROM_SIZE){
+        SDL_Log("ROM %s is %zu bytes, expected 1 to %d", path.c_str(), fileSize, MAX_ROM_SIZE);
+        close(file);
+        return false;
+    }
+    
+    // At least the two fixed banks, and only whole banks, so every bank pointer is in the mapping
+    if(fileSize >= 2 * ROM_BANK_SIZE && fileSize % ROM_BANK_SIZE == 0){
+        int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+        flags |= MAP_POPULATE;
+#endif
+        void* mapping = mmap(nullptr, fileSize, PROT_READ, flags, file, 0);
+        if(mapping != MAP_FAILED){
+            madvise(mapping, fileSize, MADV_WILLNEED);
+            data = (BYTE*) mapping;
+            size = fileSize;
+            mapped = true;
+        }
+    }
+    
+    if(!data){
+        size = std::max((size_t) 2 * ROM_BANK_SIZE, (fileSize + ROM_BANK_SIZE - 1) / ROM_BANK_SIZE * ROM_BANK_SIZE);
+        data = new BYTE[size]();
+        
+        size_t total = 0;
+        while(total < fileSize){
+            ssize_t count = read(file, data + total, fileSize - total);
+            if(count <= 0){
+                SDL_Log("Could not read ROM %s: %s", path.c_str(), count < 0 ? strerror(errno) : "unexpected end of file");
+                close(file);
+                unload();
+                return false;
+            }
+            total += count;
+        }
+    }
+    
+    close(file);
+    
+    contentHash = fnv1a(data, fileSize);
+    cartridgeType = data[0x147];
+    return true;
+}
+
+// Banks are decoded a bank per task on one thread per core, small ROMs on the caller alone.
+// An offset is decoded as if an instruction started there, whether or not one does.
+void ROMImage::predecode(){
+    predecoded.reset(new DecodedInstruction[size]);
+    decoded = predecoded.get();
+    
+    int banks = bankCount();
+    int threads = std::max(1, std::min((int) std::thread::hardware_concurrency(), banks / 16));
+    std::atomic<int> nextBank(0);
+    auto work = [&]{
+        for(int number = nextBank++; number < banks; number = nextBank++){
+            predecodeBank(number);
+        }
+    };
+    
+    std::vector<std::thread> helpers;
+    for(int i = 1; i < threads; i++){
+        helpers.emplace_back(work);
+    }
+    work();
+    for(std::thread& helper : helpers){
+        helper.join();
+    }
+}
+
+// The bank after this one in memory isn't the one after it in the ROM, so an instruction
+// running past the end is left for the CPU to decode wherever it's mapped
+void ROMImage::predecodeBank(int number){
+    const BYTE* bytes = data + (size_t) number * ROM_BANK_SIZE;
+    DecodedInstruction* instructions = predecoded.get() + (size_t) number * ROM_BANK_SIZE;
+    
+    for(int offset = 0; offset < ROM_BANK_SIZE; offset++){
+        BYTE byte1 = offset + 1 < ROM_BANK_SIZE ? bytes[offset + 1] : 0;
+        BYTE byte2 = offset + 2 < ROM_BANK_SIZE ? bytes[offset + 2] : 0;
+        instructions[offset] = decodeInstruction(bytes[offset], byte1, byte2);
+        if(offset + instructions[offset].length > ROM_BANK_SIZE){
+            instructions[offset].length = 0;
+        }
+    }
+
+#ifndef GB_PAIR_PROFILE
+    // Pairs run as one superinstruction, see CPU::handleFused(). Both have to be in the
+    // bank, and most instructions start no pair at all. A GB_PAIR_PROFILE build runs them
+    // apart, so every pair is counted.
+    bool startsFusion[512] = {};
+    for(int i = 1; i <= FUSION_COUNT; i++){
+        startsFusion[fusions[i].first] = true;
+    }
+    for(int offset = 0; offset < ROM_BANK_SIZE; offset++){
+        DecodedInstruction& first = instructions[offset];
+        int next = offset + first.length;
+        if(first.length && startsFusion[first.handler] && next < ROM_BANK_SIZE && instructions[next].length){
+            first.fusion = fusionOf(first.handler, instructions[next].handler);
+        }
+    }
+#endif
+}
+
+void ROMImage::unload(){
+    if(!data){
+        return;
+    }
+    if(mapped){
+        munmap(data, size);
+    }
+    else{
+        delete[] data;
+    }
+    data = nullptr;
+    size = 0;
+    fileSize = 0;
+    mapped = false;
+    decoded = nullptr;
+    predecoded.reset();
+    translations.reset();
+    flow.reset();
+}
+
+// Once the last machine running the ROM is done with it, if there's anything new since the
+// file was read
+void ROMImage::saveTranslations(){
+    if(!translations || !decoded){
+        return;
+    }
+    
+    std::vector<CachedBlock> hot;
+#ifdef GB_JIT_ENABLED
+    hot = compiled->hotBlocks();
+#endif
+    if(translations->instructions() && hot.size() <= (size_t) translations->hotBlockCount()){
+        return;
+    }
+    translations->save(decoded, hot);
+}
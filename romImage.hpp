@@ -0,0 +1,90 @@
+#ifndef romImage_hpp
+#define romImage_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "definitions.hpp"
+#include "isa.hpp"
+
+// 16 KB switchable ROM bank
+#define ROM_BANK_SIZE 0x4000
+
+// 512 banks, the most an MBC5 can address
+#define MAX_ROM_SIZE 0x800000
+
+class ControlFlow;
+class JIT;
+class TranslationCache;
+
+// Cartridge ROM, read only and shared by every machine running the same ROM. Mapped
+// straight from the file when the file is whole banks, otherwise copied into a buffer
+// padded out to whole banks. Anything worked out from the ROM alone belongs here too,
+// so it's only worked out once per process.
+class ROMImage{
+    
+    BYTE* data = nullptr;
+    size_t size = 0;
+    bool mapped = false;
+    
+    // Bytes read from the file, size is padded out to whole banks
+    size_t fileSize = 0;
+    
+    // FNV-1a of the file contents, and their SHA-1 for anything kept outside the process
+    uint64_t contentHash = 0;
+    BYTE contentSHA1[20] = {};
+    
+    // An instruction decoded at every offset of every bank, see ROMImage::predecode(). Read
+    // from the translation cache instead when it has them.
+    const DecodedInstruction* decoded = nullptr;
+    std::unique_ptr<DecodedInstruction[]> predecoded;
+    std::unique_ptr<TranslationCache> translations;
+    
+    // Blocks and jump targets recovered from the predecoded instructions
+    std::unique_ptr<ControlFlow> flow;
+    
+#ifdef GB_JIT_ENABLED
+    // Blocks compiled as machines running the ROM find them hot
+    std::unique_ptr<JIT> compiled;
+#endif
+
+    // Header
+    BYTE cartridgeType = 0;
+    
+    ROMImage() = default;
+    
+    bool load(const std::string& path);
+    void unload();
+    void predecode();
+    void predecodeBank(int number);
+    void saveTranslations();
+    
+public:
+    
+    ROMImage(const ROMImage&) = delete;
+    ROMImage& operator=(const ROMImage&) = delete;
+    ~ROMImage();
+    
+    // Loads the ROM, or returns the image already loaded with the same contents. Logs why
+    // through SDL_Log and returns nullptr if it can't be loaded.
+    static std::shared_ptr<const ROMImage> open(const std::string& path);
+    
+    const BYTE* bytes() const { return data; }
+    int bankCount() const { return (int) (size / ROM_BANK_SIZE); }
+    uint64_t hash() const { return contentHash; }
+    const BYTE* sha1() const { return contentSHA1; }
+    BYTE type() const { return cartridgeType; }
+    
+    // Bank numbers past the end wrap around, the MBC ignores the bits it has no ROM for
+    const BYTE* bank(int number) const { return data + (number % bankCount()) * ROM_BANK_SIZE; }
+    const DecodedInstruction* decodedBank(int number) const { return decoded + (number % bankCount()) * ROM_BANK_SIZE; }
+    const ControlFlow& controlFlow() const { return *flow; }
+
+#ifdef GB_JIT_ENABLED
+    // Safe to use from every machine's thread at once
+    JIT* jit() const { return compiled.get(); }
+#endif
+};
+
+#endif /* romImage_hpp */
@@ -0,0 +1,77 @@
+#include "scheduler.hpp"
+#include "gameboy.hpp"
+
+void Scheduler::reset(){
+    now = 0;
+    frameComplete = false;
+    for(int i = 0; i < EVENT_COUNT; i++){
+        timestamps[i] = NEVER;
+    }
+    next = NEVER;
+}
+
+void Scheduler::updateNext(){
+    next = NEVER;
+    for(int i = 0; i < EVENT_COUNT; i++){
+        if(timestamps[i] < next){
+            next = timestamps[i];
+        }
+    }
+}
+
+// Replaces the event's timestamp if it's already pending
+void Scheduler::schedule(Event event, uint64_t timestamp){
+    uint64_t previous = timestamps[event];
+    timestamps[event] = timestamp;
+    if(timestamp <= next){
+        next = timestamp;
+    }
+    else if(previous == next){
+        updateNext();
+    }
+}
+
+void Scheduler::cancel(Event event){
+    timestamps[event] = NEVER;
+    updateNext();
+}
+
+void Scheduler::advance(int clockCycles){
+    now += clockCycles;
+    
+    while(next <= now){
+        // Earliest first
+        int event = 0;
+        for(int i = 1; i < EVENT_COUNT; i++){
+            if(timestamps[i] < timestamps[event]){
+                event = i;
+            }
+        }
+        
+        uint64_t timestamp = timestamps[event];
+        timestamps[event] = NEVER;
+        updateNext();
+        dispatch((Event) event, timestamp);
+    }
+}
+
+void Scheduler::dispatch(Event event, uint64_t timestamp){
+    switch(event){
+        case EVENT_FRAME:
+            gb.apu.catchUp(timestamp);
+            frameComplete = true;
+            schedule(EVENT_FRAME, timestamp + FRAME_CYCLES);
+            break;
+        case EVENT_PPU:
+            gb.ppu.step();
+            break;
+        case EVENT_TIMER:
+            gb.timer.overflow(timestamp);
+            break;
+        case EVENT_FRAME_SEQUENCER:
+            gb.apu.clockFrameSequencer(timestamp);
+            break;
+        default:
+            break;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef scheduler_hpp
+#define scheduler_hpp
+
+#include <cstdint>
+#include "definitions.hpp"
+
+// Clock cycles per frame
+#define FRAME_CYCLES (CLOCKSPEED / 60)
+
+// Each kind of event is pending at most once, so the queue is one timestamp per kind
+// Events due at the same cycle run in this order, the frame last so it sees all of them
+enum Event : BYTE{
+    EVENT_PPU,              // PPU::step()
+    EVENT_TIMER,            // Timer::overflow()
+    EVENT_FRAME_SEQUENCER,  // APU::clockFrameSequencer()
+    EVENT_FRAME,            // end of the frame, see main.cpp
+    EVENT_COUNT
+};
+
+class GameBoy;
+
+class Scheduler{
+    
+    GameBoy& gb;
+    
+    uint64_t timestamps[EVENT_COUNT];
+    uint64_t next;
+    
+    void updateNext();
+    void dispatch(Event event, uint64_t timestamp);
+    
+public:
+    
+    explicit Scheduler(GameBoy& gb) : gb(gb){}
+    
+    static constexpr uint64_t NEVER = UINT64_MAX;
+    
+    // Master clock, in clock cycles since power on
+    uint64_t now = 0;
+    
+    bool frameComplete = false;
+    
+    void reset();
+    void schedule(Event event, uint64_t timestamp);
+    void cancel(Event event);
+    uint64_t timestampOf(Event event) const { return timestamps[event]; }
+    uint64_t nextEvent() const { return next; }
+    
+    // Moves the master clock forward, running every event that falls due in timestamp order
+    void advance(int clockCycles);
+};
+
+#endif /* scheduler_hpp */
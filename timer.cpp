@@ -1,38 +1,73 @@
 #include "timer.hpp"
+#include "gameboy.hpp"
 #include "registers.hpp"
 
-void Timer::addToClock(int clockCycles){
+void Timer::reset(){
+    dividerBase = 0;
+    counterBase = 0;
+    counter = 0;
+    control = 0;
+    controlClock = CLOCKSPEED / 4096;
+    isClockEnabled = false;
+    gb.scheduler.cancel(EVENT_TIMER);
     
-    //clockCycles /= 4;
-    
-    // handle dividers
-    dividerClock += clockCycles;
-    if(dividerClock >= 256){
-        dividerClock %= 256;
-        divider++;
+    gb.mmu.mapIO(0xFF04, [](GameBoy& gb, WORD){ return gb.timer.readDivider(); },
+                         [](GameBoy& gb, WORD, BYTE){ gb.timer.resetDivider(); });
+    gb.mmu.mapIO(0xFF05, [](GameBoy& gb, WORD){ return gb.timer.readCounter(); },
+                         [](GameBoy& gb, WORD, BYTE val){ gb.timer.writeCounter(val); });
+    gb.mmu.mapIO(0xFF06, [](GameBoy& gb, WORD){ return gb.timer.modulo; },
+                         [](GameBoy& gb, WORD, BYTE val){ gb.timer.modulo = val; });
+    gb.mmu.mapIO(0xFF07, [](GameBoy& gb, WORD){ return (BYTE) (gb.timer.control & 0x3); },
+                         [](GameBoy& gb, WORD, BYTE val){ gb.timer.writeControl(val); });
+}
+
+// DIV counts up every 256 clock cycles
+BYTE Timer::readDivider(){
+    return (gb.scheduler.now >> 8) - dividerBase;
+}
+
+void Timer::resetDivider(){
+    dividerBase = gb.scheduler.now >> 8;
+}
+
+// Folds the ticks since counterBase into counter, keeping the tick phase
+void Timer::catchUp(){
+    if(!isClockEnabled){
+        counterBase = gb.scheduler.now;
+        return;
     }
     
+    // Never reaches 256, the overflow event runs first
+    uint64_t ticks = (gb.scheduler.now - counterBase) / controlClock;
+    counter += ticks;
+    counterBase += ticks * controlClock;
+}
+
+// The counter only needs an event when it overflows
+void Timer::scheduleOverflow(){
     if(isClockEnabled){
-        
-        controlClock -= clockCycles;
-        
-        if(controlClock <= 0){
-            
-            setControlRate();
-            
-            if(counter == 0xFF){
-                counter = modulo;
-                // Request Timer Interrupt by setting bit 2 in IF Register
-                ifRegister |= 0x4;
-            }
-            else{
-                counter++;
-            }
-        }
+        gb.scheduler.schedule(EVENT_TIMER, counterBase + (uint64_t) (0x100 - counter) * controlClock);
+    }
+    else{
+        gb.scheduler.cancel(EVENT_TIMER);
     }
 }
 
-void Timer::setControlRate(){
+BYTE Timer::readCounter(){
+    catchUp();
+    return counter;
+}
+
+void Timer::writeCounter(BYTE val){
+    catchUp();
+    counter = val;
+    scheduleOverflow();
+}
+
+void Timer::writeControl(BYTE val){
+    catchUp();
+    
+    control = val;
     switch(control & 0x3){
         case 0:
             controlClock = (CLOCKSPEED / 4096);
@@ -50,6 +85,19 @@ void Timer::setControlRate(){
             break;
     }
     isClockEnabled = (control & 0x4);
+    
+    // The next tick is a whole period after the write
+    counterBase = gb.scheduler.now;
+    scheduleOverflow();
 }
 
-Timer timer;
+// Counter passed 0xFF at timestamp
+void Timer::overflow(uint64_t timestamp){
+    counter = modulo;
+    counterBase = timestamp;
+    
+    // Request Timer Interrupt by setting bit 2 in IF Register
+    gb.cpu.requestInterrupt(INTERRUPT_TIMER);
+    
+    scheduleOverflow();
+}
@@ -1,25 +1,42 @@
 #ifndef timer_hpp
 #define timer_hpp
 
+#include <cstdint>
 #include "definitions.hpp"
 
+class GameBoy;
+
 class Timer{
     
+    GameBoy& gb;
+    
+    // Master clock / 256 when DIV was last reset
+    uint64_t dividerBase = 0;
+    
+    // TIMA was counter at this master clock, and counts up every controlClock cycles from it
+    uint64_t counterBase = 0;
+    int controlClock = CLOCKSPEED / 4096;
+    
+    void catchUp();
+    void scheduleOverflow();
+    
 public:
     
-    BYTE divider = 0;
+    explicit Timer(GameBoy& gb) : gb(gb){}
+    
     BYTE counter = 0;
     BYTE modulo = 0;
     BYTE control = 0;
     
-    int controlClock = 1024;
-    int dividerClock = 0;
+    bool isClockEnabled = false;
     
-    bool isClockEnabled = true;
-    void addToClock(int clockCycles);
-    void setControlRate();
+    void reset();
+    BYTE readDivider();
+    void resetDivider();
+    BYTE readCounter();
+    void writeCounter(BYTE val);
+    void writeControl(BYTE val);
+    void overflow(uint64_t timestamp);
 };
 
-extern Timer timer;
-
 #endif /* timer_hpp */
@@ -0,0 +1,223 @@
+#include "translationCache.hpp"
+#include <SDL2/SDL.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TRANSLATION_CACHE_MAGIC "GBTRANS"
+
+// Read straight from the file, so a host with the other byte order fails the magic check
+struct CacheHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t instructionSize;
+    char buildID[64];
+    BYTE romHash[20];
+    uint32_t romSize;
+    uint32_t blockCount;
+    uint32_t reserved;
+    uint64_t decoder;           // see decoderFingerprint()
+    uint64_t payloadChecksum;   // instructions then blocks
+    uint64_t headerChecksum;    // everything before it
+};
+
+// FNV-1a a word at a time, only to catch a damaged file, which it does fast enough to
+// check the whole thing on every load
+static uint64_t checksum(const void* bytes, size_t length, uint64_t hash = 0xCBF29CE484222325){
+    const BYTE* b = (const BYTE*) bytes;
+    size_t i = 0;
+    for(; i + 8 <= length; i += 8){
+        uint64_t word;
+        memcpy(&word, b + i, 8);
+        hash = (hash ^ word) * 0x100000001B3;
+    }
+    for(; i < length; i++){
+        hash = (hash ^ b[i]) * 0x100000001B3;
+    }
+    return hash;
+}
+
+// What predecoding depends on besides the ROM and the instruction set, so a build with
+// another fusions.hpp but the same GB_BUILD_ID doesn't take the instructions as they are
+static uint64_t decoderFingerprint(){
+    int count = FUSION_COUNT;
+    return checksum(fusions, sizeof(fusions), checksum(&count, sizeof(count)));
+}
+
+// Every instruction in range of the tables CPU::execute() indexes with it. The checksums
+// only catch damage, not a file written by code that decoded differently.
+static bool isDecodable(const DecodedInstruction* instructions, size_t count){
+    for(size_t i = 0; i < count; i++){
+        const DecodedInstruction& instruction = instructions[i];
+        if(instruction.handler >= 512 || instruction.fusion > FUSION_COUNT || instruction.length > 3){
+            return false;
+        }
+    }
+    return true;
+}
+
+// The per-user directory SDL keeps for the emulator, or empty if there isn't one
+static const std::string& cacheDirectory(){
+    static const std::string directory = []{
+        char* prefPath = SDL_GetPrefPath("GB-C-Emulator", "translations");
+        std::string result = prefPath ? prefPath : "";
+        SDL_free(prefPath);
+        return result;
+    }();
+    return directory;
+}
+
+TranslationCache::TranslationCache(const BYTE* hash, size_t size) : romSize(size){
+    memcpy(romHash, hash, sizeof(romHash));
+    
+    if(!cacheDirectory().empty()){
+        char name[41];
+        for(int i = 0; i < 20; i++){
+            snprintf(name + i * 2, 3, "%02x", romHash[i]);
+        }
+        path = cacheDirectory() + name + ".gbcache";
+    }
+}
+
+TranslationCache::~TranslationCache(){
+    unmap();
+}
+
+bool TranslationCache::open(){
+    unmap();
+    if(path.empty()){
+        return false;
+    }
+    
+    int file = ::open(path.c_str(), O_RDONLY);
+    if(file < 0){
+        return false;
+    }
+    
+    struct stat fileInfo;
+    if(fstat(file, &fileInfo) < 0 || (size_t) fileInfo.st_size < sizeof(CacheHeader)){
+        SDL_Log("Translation cache %s is damaged, ignoring it", path.c_str());
+        close(file);
+        return false;
+    }
+    
+    mappingSize = fileInfo.st_size;
+    mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if(mapping == MAP_FAILED){
+        mapping = nullptr;
+        SDL_Log("Could not map translation cache %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    
+    // Checked in the order the fields can be trusted, each size before anything's read by it
+    const CacheHeader& header = *(const CacheHeader*) mapping;
+    const char* problem = nullptr;
+    char buildID[sizeof(header.buildID)] = {};
+    strncpy(buildID, ::buildID(), sizeof(buildID) - 1);
+    
+    size_t instructionsLength = (size_t) header.romSize * sizeof(DecodedInstruction);
+    size_t blocksLength = (size_t) header.blockCount * sizeof(CachedBlock);
+    
+    if(memcmp(header.magic, TRANSLATION_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != TRANSLATION_CACHE_VERSION){
+        problem = "is from another version";
+    }
+    else if(header.headerChecksum != checksum(&header, offsetof(CacheHeader, headerChecksum))){
+        problem = "is damaged";
+    }
+    else if(memcmp(header.buildID, buildID, sizeof(buildID)) != 0 || header.instructionSize != sizeof(DecodedInstruction) ||
+            header.decoder != decoderFingerprint()){
+        problem = "is from another build";
+    }
+    else if(memcmp(header.romHash, romHash, sizeof(romHash)) != 0 || header.romSize != romSize){
+        problem = "is for another ROM";
+    }
+    else if(mappingSize != sizeof(CacheHeader) + instructionsLength + blocksLength){
+        problem = "is damaged";
+    }
+    else if(header.payloadChecksum != checksum((const BYTE*) mapping + sizeof(CacheHeader), instructionsLength + blocksLength)){
+        problem = "is damaged";
+    }
+    else if(!isDecodable((const DecodedInstruction*) ((const BYTE*) mapping + sizeof(CacheHeader)), romSize)){
+        problem = "has instructions this build can't run";
+    }
+    
+    if(problem){
+        SDL_Log("Translation cache %s %s, ignoring it", path.c_str(), problem);
+        unmap();
+        return false;
+    }
+    
+    decoded = (const DecodedInstruction*) ((const BYTE*) mapping + sizeof(CacheHeader));
+    blocks = (const CachedBlock*) ((const BYTE*) decoded + instructionsLength);
+    blockCount = header.blockCount;
+    return true;
+}
+
+// Written to a file of its own and renamed over the old one, so a process that has the old
+// one mapped keeps it, and one that reads it part written finds the checksum wrong
+bool TranslationCache::save(const DecodedInstruction* instructions, const std::vector<CachedBlock>& hot){
+    if(path.empty()){
+        return false;
+    }
+    
+    size_t instructionsLength = romSize * sizeof(DecodedInstruction);
+    size_t blocksLength = hot.size() * sizeof(CachedBlock);
+    
+    CacheHeader header = {};
+    memcpy(header.magic, TRANSLATION_CACHE_MAGIC, sizeof(header.magic));
+    header.version = TRANSLATION_CACHE_VERSION;
+    header.instructionSize = sizeof(DecodedInstruction);
+    strncpy(header.buildID, buildID(), sizeof(header.buildID) - 1);
+    memcpy(header.romHash, romHash, sizeof(romHash));
+    header.romSize = (uint32_t) romSize;
+    header.blockCount = (uint32_t) hot.size();
+    header.decoder = decoderFingerprint();
+    header.payloadChecksum = checksum(hot.data(), blocksLength, checksum(instructions, instructionsLength));
+    header.headerChecksum = checksum(&header, offsetof(CacheHeader, headerChecksum));
+    
+    std::string temporary = path + "." + std::to_string(getpid());
+    int file = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(file < 0){
+        SDL_Log("Could not write translation cache %s: %s", temporary.c_str(), strerror(errno));
+        return false;
+    }
+    
+    const void* parts[] = {&header, instructions, hot.data()};
+    size_t lengths[] = {sizeof(header), instructionsLength, blocksLength};
+    bool written = true;
+    for(int i = 0; i < 3 && written; i++){
+        const BYTE* b = (const BYTE*) parts[i];
+        size_t total = 0;
+        while(total < lengths[i]){
+            ssize_t count = write(file, b + total, lengths[i] - total);
+            if(count <= 0){
+                written = false;
+                break;
+            }
+            total += count;
+        }
+    }
+    
+    if(close(file) < 0 || !written || rename(temporary.c_str(), path.c_str()) < 0){
+        SDL_Log("Could not write translation cache %s: %s", path.c_str(), strerror(errno));
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+void TranslationCache::unmap(){
+    if(mapping){
+        munmap(mapping, mappingSize);
+    }
+    mapping = nullptr;
+    mappingSize = 0;
+    decoded = nullptr;
+    blocks = nullptr;
+    blockCount = 0;
+}
@@ -0,0 +1,63 @@
+#ifndef translationCache_hpp
+#define translationCache_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "definitions.hpp"
+#include "isa.hpp"
+
+// Bumped whenever the layout of the file changes
+#define TRANSLATION_CACHE_VERSION 3
+
+// A block start found hot by the JIT, compiled as soon as the ROM is loaded next time
+struct CachedBlock{
+    uint32_t offset;    // into the ROM
+    WORD start;         // PC it ran from
+    WORD reserved;
+};
+
+// What's worked out from a ROM kept in a file between runs, so short-lived processes don't
+// pay for it again: the predecoded instructions and the blocks the JIT found hot. A file
+// is for one ROM, by its SHA-1, and one build of the emulator. It's mapped rather than
+// read, and only ever replaced whole, never written in place, so a file mapped by one
+// process can't change under it.
+class TranslationCache{
+    
+    BYTE romHash[20];
+    size_t romSize;
+    std::string path;
+    
+    void* mapping = nullptr;
+    size_t mappingSize = 0;
+    const DecodedInstruction* decoded = nullptr;
+    const CachedBlock* blocks = nullptr;
+    int blockCount = 0;
+    
+    void unmap();
+    
+public:
+    
+    // For the ROM with the SHA-1 hash, of size bytes padded out to whole banks. Finds nothing
+    // if there's nowhere to keep the files.
+    TranslationCache(const BYTE* hash, size_t size);
+    TranslationCache(const TranslationCache&) = delete;
+    TranslationCache& operator=(const TranslationCache&) = delete;
+    ~TranslationCache();
+    
+    // Maps the file for the ROM. Returns false, with nothing mapped, if there isn't one or
+    // it's from another build, or it's damaged. Those are logged and left to be replaced.
+    bool open();
+    
+    // A decoded instruction for every byte of the ROM, nullptr until open() succeeds
+    const DecodedInstruction* instructions() const { return decoded; }
+    
+    const CachedBlock* hotBlocks() const { return blocks; }
+    int hotBlockCount() const { return blockCount; }
+    
+    // Writes a new file for the ROM in place of any there. What's mapped stays as it was.
+    bool save(const DecodedInstruction* instructions, const std::vector<CachedBlock>& hot);
+};
+
+#endif /* translationCache_hpp */